@@ -0,0 +1,316 @@
+#include "auditlog.h"
+#include "iowrapper.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// a thread asks for an early flush once its buffer holds this many bytes
+#define AUDIT_BATCH (64 * 1024)
+
+// one entry as stored in a buffer, the line follows the header
+struct record {
+    uint64_t seq;
+    uint32_t len;
+};
+
+// a growable run of records, filled by one thread and swapped out by the writer
+struct buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// the per-thread side of a buffer, reused by a later thread once its owner exits
+struct local {
+    pthread_mutex_t lock;
+    struct buffer buf;
+    bool owned;
+    struct local *next;
+};
+
+struct auditlog {
+    int fd;
+    int flush_ms;
+
+    atomic_uint_fast64_t seq;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct local *locals;
+    bool stop;
+
+    // set once the writer is told to stop, from then on loggers flush themselves
+    atomic_bool stopped;
+    pthread_mutex_t flush_lock;
+
+    pthread_key_t key;
+    pthread_t writer;
+
+    // written under flush_lock only: the next sequence number to write and
+    // the records that arrived ahead of it
+    uint64_t next_seq;
+    struct buffer carry;
+};
+
+// one record located in a merged batch
+struct entry {
+    uint64_t seq;
+    const char *line;
+    uint32_t len;
+};
+
+static _Thread_local struct local *tls_local;
+
+static void buffer_append(struct buffer *b, const void *src, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap == 0 ? 4096 : b->cap;
+        while (cap < b->len + n) {
+            cap *= 2;
+        }
+        b->data = realloc(b->data, cap);
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+}
+
+static void local_release(void *arg) {
+    // the buffer stays with the log, the writer drains it and the next new thread adopts it
+    struct local *l = (struct local *) arg;
+    pthread_mutex_lock(&(l->lock));
+    l->owned = false;
+    pthread_mutex_unlock(&(l->lock));
+}
+
+static struct local *local_get(auditlog_t *log) {
+    if (tls_local != NULL) {
+        return tls_local;
+    }
+
+    pthread_mutex_lock(&(log->lock));
+
+    struct local *l = log->locals;
+    while (l != NULL && l->owned) {
+        l = l->next;
+    }
+
+    if (l == NULL) {
+        l = (struct local *) calloc(1, sizeof(struct local));
+        pthread_mutex_init(&(l->lock), NULL);
+        l->next = log->locals;
+        log->locals = l;
+    }
+    l->owned = true;
+
+    pthread_mutex_unlock(&(log->lock));
+
+    pthread_setspecific(log->key, l);
+    tls_local = l;
+
+    return l;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    uint64_t x = ((const struct entry *) a)->seq;
+    uint64_t y = ((const struct entry *) b)->seq;
+    return (x > y) - (x < y);
+}
+
+static void flush_locked(auditlog_t *log) {
+    // gather what is left over from the last round and everything buffered since
+    struct buffer batch = log->carry;
+    memset(&(log->carry), 0, sizeof(struct buffer));
+
+    pthread_mutex_lock(&(log->lock));
+    for (struct local *l = log->locals; l != NULL; l = l->next) {
+        pthread_mutex_lock(&(l->lock));
+        if (l->buf.len > 0) {
+            buffer_append(&batch, l->buf.data, l->buf.len);
+            l->buf.len = 0;
+        }
+        pthread_mutex_unlock(&(l->lock));
+    }
+    pthread_mutex_unlock(&(log->lock));
+
+    if (batch.len == 0) {
+        free(batch.data);
+        return;
+    }
+
+    // index and order the batch by sequence number
+    size_t count = 0;
+    for (size_t off = 0; off < batch.len; count++) {
+        struct record r;
+        memcpy(&r, batch.data + off, sizeof(r));
+        off += sizeof(r) + r.len;
+    }
+
+    struct entry *entries = (struct entry *) malloc(count * sizeof(struct entry));
+    size_t i = 0;
+    for (size_t off = 0; off < batch.len; i++) {
+        struct record r;
+        memcpy(&r, batch.data + off, sizeof(r));
+        entries[i].seq = r.seq;
+        entries[i].line = batch.data + off + sizeof(r);
+        entries[i].len = r.len;
+        off += sizeof(r) + r.len;
+    }
+    qsort(entries, count, sizeof(struct entry), entry_cmp);
+
+    // write the run with no gaps, a thread that took a sequence number may not
+    // have appended its entry yet, so anything past a gap waits for the next round
+    struct buffer out = { NULL, 0, 0 };
+    for (i = 0; i < count && entries[i].seq == log->next_seq; i++) {
+        buffer_append(&out, entries[i].line, entries[i].len);
+        log->next_seq += 1;
+    }
+    for (; i < count; i++) {
+        struct record r = { entries[i].seq, entries[i].len };
+        buffer_append(&(log->carry), &r, sizeof(r));
+        buffer_append(&(log->carry), entries[i].line, entries[i].len);
+    }
+
+    if (out.len > 0) {
+        write_n_bytes(log->fd, out.data, out.len);
+    }
+
+    free(out.data);
+    free(entries);
+    free(batch.data);
+}
+
+static void flush(auditlog_t *log) {
+    pthread_mutex_lock(&(log->flush_lock));
+    flush_locked(log);
+    pthread_mutex_unlock(&(log->flush_lock));
+}
+
+static void *writer_exec(void *arg) {
+    auditlog_t *log = (auditlog_t *) arg;
+
+    pthread_mutex_lock(&(log->lock));
+    while (!log->stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long) log->flush_ms * 1000000;
+        ts.tv_sec += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&(log->wake), &(log->lock), &ts);
+
+        pthread_mutex_unlock(&(log->lock));
+        flush(log);
+        pthread_mutex_lock(&(log->lock));
+    }
+    pthread_mutex_unlock(&(log->lock));
+
+    // every sequence number has been appended by now, so this drains the log
+    flush(log);
+
+    return NULL;
+}
+
+auditlog_t *auditlog_new(int fd, int flush_ms) {
+    if (fd < 0 || flush_ms < 1) {
+        return NULL;
+    }
+
+    auditlog_t *log = (auditlog_t *) calloc(1, sizeof(auditlog_t));
+    log->fd = fd;
+    log->flush_ms = flush_ms;
+    atomic_init(&(log->seq), 0);
+    atomic_init(&(log->stopped), false);
+    pthread_mutex_init(&(log->lock), NULL);
+    pthread_mutex_init(&(log->flush_lock), NULL);
+    pthread_cond_init(&(log->wake), NULL);
+    pthread_key_create(&(log->key), local_release);
+
+    if (pthread_create(&(log->writer), NULL, writer_exec, log) != 0) {
+        pthread_key_delete(log->key);
+        pthread_cond_destroy(&(log->wake));
+        pthread_mutex_destroy(&(log->flush_lock));
+        pthread_mutex_destroy(&(log->lock));
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+void auditlog_stop(auditlog_t *log) {
+    pthread_mutex_lock(&(log->lock));
+    if (log->stop) {
+        pthread_mutex_unlock(&(log->lock));
+        return;
+    }
+    log->stop = true;
+    atomic_store(&(log->stopped), true);
+    pthread_cond_signal(&(log->wake));
+    pthread_mutex_unlock(&(log->lock));
+
+    pthread_join(log->writer, NULL);
+}
+
+void auditlog_delete(auditlog_t **log) {
+    auditlog_t *l = *log;
+
+    auditlog_stop(l);
+
+    struct local *next;
+    for (struct local *cur = l->locals; cur != NULL; cur = next) {
+        next = cur->next;
+        pthread_mutex_destroy(&(cur->lock));
+        free(cur->buf.data);
+        free(cur);
+    }
+
+    free(l->carry.data);
+    pthread_key_delete(l->key);
+    pthread_cond_destroy(&(l->wake));
+    pthread_mutex_destroy(&(l->flush_lock));
+    pthread_mutex_destroy(&(l->lock));
+    free(l);
+    *log = NULL;
+}
+
+uint64_t auditlog_write(auditlog_t *log, const char *method, const char *uri, uint16_t code,
+    const char *id) {
+    struct local *l = local_get(log);
+
+    char line[512];
+    int n = snprintf(line, sizeof(line), "%s,/%s,%hu,%s\n", method, uri, code, id);
+    if (n < 0) {
+        n = 0;
+    } else if ((size_t) n >= sizeof(line)) {
+        // keep the entry on one line even if the request id is absurdly long
+        n = sizeof(line) - 1;
+        line[n - 1] = '\n';
+    }
+
+    // take the sequence number under the thread's own lock, so the entry is in the
+    // buffer by the time the writer can look at this buffer again
+    pthread_mutex_lock(&(l->lock));
+    struct record r = { atomic_fetch_add(&(log->seq), 1), (uint32_t) n };
+    buffer_append(&(l->buf), &r, sizeof(r));
+    buffer_append(&(l->buf), line, n);
+    bool full = l->buf.len >= AUDIT_BATCH;
+    pthread_mutex_unlock(&(l->lock));
+
+    // once the writer has stopped, either its last flush saw this entry or the
+    // stop came first and the entry is ours to write
+    if (atomic_load(&(log->stopped))) {
+        flush(log);
+    }
+    // a busy thread does not wait for the timer to have its batch written
+    else if (full) {
+        pthread_cond_signal(&(log->wake));
+    }
+
+    return r.seq;
+}
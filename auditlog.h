@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct auditlog auditlog_t;
+
+/** @brief Dynamically allocates and initializes a new audit log that
+ *         writes to fd, and starts its writer thread.  Entries are
+ *         buffered per thread and written in sequence order in batches
+ *         at least every flush_ms milliseconds.
+ *
+ *  @param fd the file descriptor the log is written to.
+ *
+ *  @param flush_ms the longest an entry waits before it is written.
+ *
+ *  @return a pointer to a new auditlog_t, or NULL on failure.
+ */
+auditlog_t *auditlog_new(int fd, int flush_ms);
+
+/** @brief Stop the writer thread and write out every entry logged so
+ *         far.  The log stays usable, threads that log afterwards write
+ *         their entries themselves before auditlog_write returns.  Safe
+ *         to call more than once.
+ *
+ *  @param log the audit log to be stopped.
+ */
+void auditlog_stop(auditlog_t *log);
+
+/** @brief Stop the writer thread, write out every entry and free all of
+ *         the log's memory.  No thread may still be logging.
+ *
+ *  @param log the audit log to be deleted.
+ */
+void auditlog_delete(auditlog_t **log);
+
+/** @brief append the entry "<method>,/<uri>,<code>,<id>" to the calling
+ *         thread's buffer.  The entry's place in the log is fixed by this
+ *         call, so it must be made at the request's linearization point.
+ *         Never blocks on I/O.
+ *
+ *  @return the sequence number of the entry.
+ */
+uint64_t auditlog_write(auditlog_t *log, const char *method, const char *uri, uint16_t code,
+    const char *id);
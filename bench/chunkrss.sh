@@ -0,0 +1,55 @@
+#!/bin/sh
+# Starts httpserver, uploads files of growing size with chunked PUTs from
+# curl, and checks that the server's peak resident set size stays flat, i.e.
+# that chunked bodies are streamed into the file rather than held in memory.
+# Runs once spliced and once on the read/write path (-Z). Fails if the peak
+# after the largest upload is more than slack_kb above the one after the
+# smallest.
+#
+# usage: bench/chunkrss.sh <port> "<httpserver options>" [sizes in MiB] [slack_kb]
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+. "$root/bench/lib.sh"
+
+port=$1
+server_args=$2
+sizes=${3:-"1 16 64 256"}
+slack_kb=${4:-1024}
+
+# the server's peak resident set size so far, in KiB
+server_hwm() {
+    awk '$1 == "VmHWM:" { print $2 }' "/proc/$pid/status"
+}
+
+status=0
+for mode in "" "-Z"; do
+    server_start "$port" $server_args $mode
+    echo "options: ${server_args:+$server_args }${mode:-(default)}"
+
+    first=
+    for mib in $sizes; do
+        # curl sends a body read from stdin with Transfer-Encoding: chunked
+        code=$(head -c "$((mib * 1048576))" /dev/zero \
+            | curl -s -o /dev/null -w "%{http_code}" -T - "http://127.0.0.1:$port/upload")
+        hwm=$(server_hwm)
+        first=${first:-$hwm}
+        printf "%6s MiB  status %s  peak rss %8s KiB\n" "$mib" "$code" "$hwm"
+        if [ "$code" != 200 ] && [ "$code" != 201 ]; then
+            status=1
+        fi
+    done
+
+    if [ $((hwm - first)) -gt "$slack_kb" ]; then
+        echo "peak rss grew by $((hwm - first)) KiB (max $slack_kb KiB)  FAIL"
+        status=1
+    else
+        echo "peak rss grew by $((hwm - first)) KiB (max $slack_kb KiB)"
+    fi
+    echo
+
+    server_stop
+done
+
+exit $status
@@ -0,0 +1,98 @@
+#!/bin/sh
+# Runs bench/loadgen with the same options against httpserver once per
+# configuration, each time in a fresh scratch directory, and prints a row
+# per configuration: throughput, latency percentiles, errors and the CPU
+# the server used (100% is one CPU). Fails if any run had errors.
+#
+# With COUNT_CALLS set to a list of calls, e.g. COUNT_CALLS="recv write
+# splice", every configuration gets a second, COUNT_SECONDS long run with
+# bench/syscount.so preloaded, and a second table gives how many of each call
+# the server made per request. The shim slows the server down, which is why
+# the counts come from their own run.
+#
+# Options after a -- in a configuration go to loadgen instead, e.g. "-- -K"
+# compares a new connection per request against the common options.
+#
+# usage: bench/compare.sh <port> "<httpserver options>" "<loadgen options>" "<options to compare>"...
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+. "$root/bench/lib.sh"
+
+port=$1
+common_args=$2
+loadgen_args=$3
+shift 3
+
+out=$(mktemp)
+
+printf "%-20s %10s %9s %10s %10s %10s %7s %7s\n" "options" "req/s" "MiB/s" "p50 us" "p99 us" "p999 us" "errors" "cpu %"
+
+status=0
+# splits a configuration into the server's options and loadgen's
+split_config() {
+    server_opts=${1%%--*}
+    case "$1" in
+        *--*) client_opts=${1#*--} ;;
+        *) client_opts= ;;
+    esac
+}
+
+for config in "$@"; do
+    split_config "$config"
+    server_start "$port" $common_args $server_opts
+
+    before=$(server_ticks)
+    start=$(date +%s.%N)
+    "$root/bench/loadgen" $loadgen_args $client_opts 127.0.0.1 "$port" > "$out" || status=1
+    seconds=$(awk -v a="$start" -v b="$(date +%s.%N)" 'BEGIN { print b - a }')
+    cpu=$(cpu_percent "$before" "$(server_ticks)" "$seconds")
+
+    server_stop
+
+    awk -v label="${config:-(default)}" -v cpu="$cpu" '
+        /^requests:/ { errors = $NF }
+        /^throughput:/ { rps = $2; mibs = $4 }
+        /^latency:/ { p50 = $3; p99 = $5; p999 = $7; sub(/us,/, "", p50); sub(/us,/, "", p99); sub(/us,/, "", p999) }
+        END { printf "%-20s %10s %9s %10s %10s %10s %7s %7s\n", label, rps, mibs, p50, p99, p999, errors, cpu }' "$out"
+done
+
+if [ -n "$COUNT_CALLS" ]; then
+    echo
+    printf "%-20s" "calls per request"
+    for call in $COUNT_CALLS; do
+        printf " %14s" "$call"
+    done
+    echo
+
+    log=$(mktemp)
+    for config in "$@"; do
+        : > "$log"
+        split_config "$config"
+        server_env="SYSCOUNT_LOG=$log LD_PRELOAD=$root/bench/syscount.so"
+        server_start "$port" $common_args $server_opts
+        server_env=
+
+        # a later -d wins over the one in the loadgen options
+        "$root/bench/loadgen" $loadgen_args $client_opts -d "${COUNT_SECONDS:-2}" 127.0.0.1 "$port" > /dev/null || status=1
+        served=$(curl -s "http://127.0.0.1:$port/.metrics" | awk '$1 == "httpserver_requests_total" { print $2 }')
+
+        server_stop
+
+        awk -v label="${config:-(default)}" -v calls="$COUNT_CALLS" -v served="$served" '
+            { count[$1]++ }
+            END {
+                line = sprintf("%-20s", label)
+                k = split(calls, c, " ")
+                for (i = 1; i <= k; i++) {
+                    line = line sprintf(" %14.2f", served > 0 ? count[c[i]] / served : 0)
+                }
+                print line
+            }' "$log"
+    done
+    rm -f "$log"
+fi
+
+rm -f "$out"
+exit $status
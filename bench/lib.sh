@@ -0,0 +1,51 @@
+# Helpers shared by the bench scripts, sourced after root is set.
+
+# starts httpserver in a fresh scratch directory with the audit log sent to
+# /dev/null (an explicit -l in the options still wins), waits until it
+# answers, and stops it again when the script exits; sets dir and pid.
+# Variable assignments in server_env, such as LD_PRELOAD=..., go to the
+# server's environment.
+server_start() {
+    port=$1
+    shift
+
+    dir=$(mktemp -d)
+    cd "$dir"
+    env $server_env "$root/httpserver" -l /dev/null "$@" "$port" &
+    pid=$!
+    trap 'server_stop' EXIT
+
+    tries=0
+    until curl -s -o /dev/null "http://127.0.0.1:$port/"; do
+        tries=$((tries + 1))
+        if [ $tries -ge 50 ]; then
+            echo "httpserver did not start on port $port" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+server_stop() {
+    if [ -n "$pid" ]; then
+        kill $pid 2>/dev/null
+        wait $pid 2>/dev/null || true
+        pid=
+    fi
+    if [ -n "$dir" ]; then
+        cd /
+        rm -rf "$dir"
+        dir=
+    fi
+}
+
+# CPU time the server has used so far, in clock ticks
+server_ticks() {
+    awk '{ print $14 + $15 }' "/proc/$pid/stat"
+}
+
+# percent of one CPU the server used between two server_ticks readings taken
+# seconds apart
+cpu_percent() {
+    awk -v a="$1" -v b="$2" -v s="$3" -v hz="$(getconf CLK_TCK)" 'BEGIN { printf "%.1f", (b - a) * 100 / hz / s }'
+}
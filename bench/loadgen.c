@@ -0,0 +1,713 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "usage: %s [-c connections] [-d seconds] [-w put_percent] [-f files] [-s size|min:max] [-z skew] [-b on_ms:off_ms] [-K] [-v] [-C chunk_size] [-g] <host> <port>\n"
+
+// latency histogram: 2^SUB_BITS linear sub-buckets per power of two nanoseconds, about 3% precision
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+
+// how long a client waits on the server before it counts the request as failed
+#define IO_TIMEOUT_S 5
+
+// longest ETag a client remembers
+#define ETAG_LEN 64
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                   STRUCTS
+//-----------------------------------------------------------------------------------------------------------------
+
+struct client {
+    int id;
+    pthread_t thread;
+    uint64_t rng;
+    int fd;
+
+    uint64_t hist[HIST_BUCKETS];
+    uint64_t gets;
+    uint64_t puts;
+    uint64_t ok;
+    uint64_t errors;
+    uint64_t bytes;
+
+    // bytes of GET responses as they came off the socket, headers included
+    uint64_t get_wire;
+    uint64_t not_modified;
+
+    // the last ETag seen for each file, when revalidating
+    char (*etags)[ETAG_LEN];
+};
+
+typedef struct client client_t;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+struct sockaddr_in server_addr;
+
+int connections = 16;
+int duration_s = 10;
+int put_percent = 10;
+int num_files = 100;
+size_t min_size = 4096;
+size_t max_size = 4096;
+double skew = 0.0;
+int burst_on_ms = 0;
+int burst_off_ms = 0;
+bool keep_alive = true;
+bool revalidate = false;
+size_t chunk_size = 0;
+bool accept_gzip = false;
+
+size_t* file_sizes;
+double* file_cdf;
+char* body;
+
+uint64_t start_ns;
+uint64_t end_ns;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int, char** );
+
+uint64_t now_ns(void );
+uint64_t rng_next(uint64_t* );
+double rng_unit(uint64_t* );
+
+void files_init(void );
+void print_gzip_stats(void );
+int pick_file(uint64_t* );
+
+int connect_server(void );
+bool send_all(int, const char*, size_t );
+bool send_chunked(int, const char*, size_t );
+int recv_response(int, uint64_t*, uint64_t*, char* );
+int do_request(client_t*, bool, int );
+
+void* client_exec(void* );
+
+void hist_record(uint64_t*, uint64_t );
+uint64_t hist_percentile(uint64_t*, uint64_t, double );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    MAIN
+//-----------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+
+    get_args(argc, argv);
+    files_init();
+
+    // the server may still be starting up, give it a few seconds to listen
+    client_t setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.fd = connect_server();
+    for (int tries = 0; tries < 50 && setup.fd < 0; tries++) {
+        usleep(100000);
+        setup.fd = connect_server();
+    }
+    if (setup.fd < 0) {
+        fprintf(stderr, "cannot reach the server\n");
+        exit(1);
+    }
+
+    // every file exists before the clock starts, so GETs measure serving and not 404s
+    for (int i = 0; i < num_files; i++) {
+        do_request(&setup, true, i);
+    }
+    if (setup.errors > 0) {
+        fprintf(stderr, "cannot create the bench files\n");
+        exit(1);
+    }
+    if (setup.fd >= 0) {
+        close(setup.fd);
+    }
+
+    client_t* clients = (client_t* ) calloc(connections, sizeof(client_t));
+
+    start_ns = now_ns();
+    end_ns = start_ns + (uint64_t) duration_s * 1000000000ull;
+
+    for (int i = 0; i < connections; i++) {
+        clients[i].id = i;
+        clients[i].rng = 0x9e3779b97f4a7c15ull * (uint64_t) (i + 1);
+        clients[i].fd = -1;
+        pthread_create(&clients[i].thread, NULL, client_exec, &clients[i]);
+    }
+
+    // merge every client's counts
+    client_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < connections; i++) {
+        pthread_join(clients[i].thread, NULL);
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            total.hist[b] += clients[i].hist[b];
+        }
+        total.gets += clients[i].gets;
+        total.puts += clients[i].puts;
+        total.ok += clients[i].ok;
+        total.errors += clients[i].errors;
+        total.bytes += clients[i].bytes;
+        total.get_wire += clients[i].get_wire;
+        total.not_modified += clients[i].not_modified;
+    }
+
+    double secs = (double) (now_ns() - start_ns) / 1e9;
+    uint64_t count = total.gets + total.puts;
+
+    printf("connections: %d, duration: %.2fs, files: %d, size: %zu-%zu, skew: %.2f, put: %d%%, keep-alive: %s, revalidate: %s\n",
+        connections, secs, num_files, min_size, max_size, skew, put_percent, keep_alive ? "on" : "off",
+        revalidate ? "on" : "off");
+    printf("requests: %lu (GET %lu, PUT %lu), 2xx/304: %lu, errors: %lu\n", (unsigned long) count,
+        (unsigned long) total.gets, (unsigned long) total.puts, (unsigned long) total.ok,
+        (unsigned long) total.errors);
+    printf("GET responses on the wire: %.1f MiB, %.0f bytes per GET, 304: %lu\n",
+        (double) total.get_wire / (1024.0 * 1024.0),
+        total.gets > 0 ? (double) total.get_wire / (double) total.gets : 0.0, (unsigned long) total.not_modified);
+    printf("throughput: %.1f req/s, %.1f MiB/s\n", (double) count / secs,
+        (double) total.bytes / secs / (1024.0 * 1024.0));
+    printf("latency: p50 %.1fus, p99 %.1fus, p999 %.1fus, max %.1fus\n",
+        (double) hist_percentile(total.hist, count, 0.50) / 1000.0,
+        (double) hist_percentile(total.hist, count, 0.99) / 1000.0,
+        (double) hist_percentile(total.hist, count, 0.999) / 1000.0,
+        (double) hist_percentile(total.hist, count, 1.0) / 1000.0);
+
+    if (accept_gzip) {
+        print_gzip_stats();
+    }
+
+    free(clients);
+    free(file_sizes);
+    free(file_cdf);
+    free(body);
+
+    return total.errors > 0 ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:w:f:s:z:b:KvC:g")) != -1) {
+        switch (opt) {
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'd':
+                duration_s = atoi(optarg);
+                break;
+            case 'w':
+                put_percent = atoi(optarg);
+                break;
+            case 'f':
+                num_files = atoi(optarg);
+                break;
+            case 's':
+                // a single size, or min:max for sizes spread log-uniformly between the two
+                min_size = (size_t) strtoull(optarg, NULL, 10);
+                max_size = strchr(optarg, ':') ? (size_t) strtoull(strchr(optarg, ':') + 1, NULL, 10) : min_size;
+                break;
+            case 'z':
+                skew = atof(optarg);
+                break;
+            case 'b':
+                burst_on_ms = atoi(optarg);
+                burst_off_ms = strchr(optarg, ':') ? atoi(strchr(optarg, ':') + 1) : 0;
+                break;
+            case 'K':
+                keep_alive = false;
+                break;
+            case 'v':
+                revalidate = true;
+                break;
+            case 'C':
+                chunk_size = (size_t) strtoull(optarg, NULL, 10);
+                break;
+            case 'g':
+                accept_gzip = true;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind != argc - 2 || connections < 1 || duration_s < 1 || put_percent < 0 || put_percent > 100
+        || num_files < 1 || min_size < 1 || max_size < min_size || skew < 0.0 || burst_on_ms < 0
+        || burst_off_ms < 0) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons((uint16_t) atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid host: %s\n", argv[optind]);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t rng_next(uint64_t* state) {
+
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+double rng_unit(uint64_t* state) {
+
+    return (double) (rng_next(state) >> 11) / (double) (1ull << 53);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void files_init(void) {
+
+    file_sizes = (size_t* ) malloc(sizeof(size_t) * num_files);
+    file_cdf = (double* ) malloc(sizeof(double) * num_files);
+    body = (char* ) malloc(max_size);
+    memset(body, 'x', max_size);
+
+    // a run of x compresses to nothing, with -g the files are made of words instead
+    if (accept_gzip) {
+        static const char* words[] = { "the", "server", "request", "thread", "lock", "queue", "file", "of",
+            "and", "response", "header", "worker", "to", "a", "slot", "cache" };
+        uint64_t seed = 7;
+        for (size_t off = 0; off < max_size; ) {
+            const char* w = words[rng_next(&seed) % (sizeof(words) / sizeof(words[0]))];
+            for (size_t i = 0; w[i] != '\0' && off < max_size; i++) {
+                body[off++] = w[i];
+            }
+            if (off < max_size) {
+                body[off++] = rng_next(&seed) % 12 == 0 ? '\n' : ' ';
+            }
+        }
+    }
+
+    uint64_t rng = 42;
+    double sum = 0.0;
+
+    for (int i = 0; i < num_files; i++) {
+        // log-uniform, so small and large files are equally represented per order of magnitude
+        double lo = log((double) min_size);
+        double hi = log((double) max_size);
+        file_sizes[i] = (size_t) exp(lo + (hi - lo) * rng_unit(&rng));
+        if (file_sizes[i] < min_size) {
+            file_sizes[i] = min_size;
+        }
+        if (file_sizes[i] > max_size) {
+            file_sizes[i] = max_size;
+        }
+
+        // zipf weights, file 0 is the hottest, skew 0 is uniform
+        sum += 1.0 / pow((double) (i + 1), skew);
+        file_cdf[i] = sum;
+    }
+
+    for (int i = 0; i < num_files; i++) {
+        file_cdf[i] /= sum;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void print_gzip_stats(void) {
+
+    // the server counts what it compressed, read it off the metrics page
+    int fd = connect_server();
+    char req[] = "GET /.metrics HTTP/1.1\r\nConnection: close\r\n\r\n";
+    if (fd < 0 || !send_all(fd, req, strlen(req))) {
+        fprintf(stderr, "cannot read the server's gzip counters\n");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    char page[65536];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(page) - 1 && ((n = recv(fd, page + len, sizeof(page) - 1 - len, 0)) > 0
+        || (n < 0 && errno == EINTR))) {
+        len += n > 0 ? (size_t) n : 0;
+    }
+    page[len] = '\0';
+    close(fd);
+
+    double files = 0, in = 0, out = 0, cpu = 0;
+    char* p;
+    if ((p = strstr(page, "\nhttpserver_gzip_files_total ")) != NULL) {
+        files = atof(p + strlen("\nhttpserver_gzip_files_total "));
+    }
+    if ((p = strstr(page, "\nhttpserver_gzip_input_bytes_total ")) != NULL) {
+        in = atof(p + strlen("\nhttpserver_gzip_input_bytes_total "));
+    }
+    if ((p = strstr(page, "\nhttpserver_gzip_output_bytes_total ")) != NULL) {
+        out = atof(p + strlen("\nhttpserver_gzip_output_bytes_total "));
+    }
+    if ((p = strstr(page, "\nhttpserver_gzip_cpu_seconds_total ")) != NULL) {
+        cpu = atof(p + strlen("\nhttpserver_gzip_cpu_seconds_total "));
+    }
+
+    printf("gzip: %.0f files, ratio %.2f, cpu %.1fms total, %.1fms per MiB compressed\n", files,
+        out > 0 ? in / out : 0.0, cpu * 1000.0, in > 0 ? cpu * 1000.0 / (in / (1024.0 * 1024.0)) : 0.0);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int pick_file(uint64_t* rng) {
+
+    double u = rng_unit(rng);
+    int lo = 0;
+    int hi = num_files - 1;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (file_cdf[mid] < u) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int connect_server(void) {
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct timeval tv = { .tv_sec = IO_TIMEOUT_S, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, (struct sockaddr* ) &server_addr, sizeof(server_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool send_all(int fd, const char* buf, size_t n) {
+
+    for (size_t off = 0; off < n; ) {
+        ssize_t sent = send(fd, buf + off, n - off, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        off += (size_t) sent;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool send_chunked(int fd, const char* buf, size_t n) {
+
+    // chunk_size bytes per chunk, then the last chunk with no trailers
+    char line[32];
+    for (size_t off = 0; off < n; ) {
+        size_t len = n - off < chunk_size ? n - off : chunk_size;
+        int l = snprintf(line, sizeof(line), "%zx\r\n", len);
+        if (!send_all(fd, line, (size_t) l) || !send_all(fd, buf + off, len) || !send_all(fd, "\r\n", 2)) {
+            return false;
+        }
+        off += len;
+    }
+
+    return send_all(fd, "0\r\n\r\n", 5);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int recv_response(int fd, uint64_t* bytes, uint64_t* wire, char* etag) {
+
+    // read up to the end of the headers, keeping whatever body came along with them
+    char head[4096];
+    size_t len = 0;
+    char* end = NULL;
+
+    while (end == NULL) {
+        if (len == sizeof(head) - 1) {
+            return -1;
+        }
+        ssize_t n = recv(fd, head + len, sizeof(head) - 1 - len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        len += (size_t) n;
+        head[len] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+
+    int status = 0;
+    if (sscanf(head, "HTTP/%*d.%*d %d", &status) != 1) {
+        return -1;
+    }
+
+    size_t content_length = 0;
+    char* cl = strcasestr(head, "\r\nContent-Length:");
+    if (cl != NULL && cl < end) {
+        content_length = (size_t) strtoull(cl + strlen("\r\nContent-Length:"), NULL, 10);
+    }
+
+    // remember the validator, if asked to and the server sent one
+    char* tag = strcasestr(head, "\r\nETag:");
+    if (etag != NULL && tag != NULL && tag < end) {
+        sscanf(tag + strlen("\r\nETag:"), " %63s", etag);
+    }
+
+    // drain the rest of the body
+    size_t have = len - (size_t) (end + 4 - head);
+    char sink[65536];
+    while (have < content_length) {
+        size_t want = content_length - have < sizeof(sink) ? content_length - have : sizeof(sink);
+        ssize_t n = recv(fd, sink, want, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        have += (size_t) n;
+    }
+
+    *bytes += content_length;
+    *wire += (size_t) (end + 4 - head) + content_length;
+    return status;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int do_request(client_t* c, bool put, int file) {
+
+    bool reused = c->fd >= 0;
+    if (c->fd < 0) {
+        c->fd = connect_server();
+        if (c->fd < 0) {
+            c->errors += 1;
+            return -1;
+        }
+    }
+
+    char req[256];
+    size_t size = file_sizes[file];
+    int len;
+    if (put && chunk_size > 0) {
+        len = snprintf(req, sizeof(req), "PUT /bench%d.dat HTTP/1.1\r\nTransfer-Encoding: chunked\r\n%s\r\n", file,
+            keep_alive ? "" : "Connection: close\r\n");
+    }
+    else if (put) {
+        len = snprintf(req, sizeof(req), "PUT /bench%d.dat HTTP/1.1\r\nContent-Length: %zu\r\n%s\r\n", file, size,
+            keep_alive ? "" : "Connection: close\r\n");
+    }
+    else {
+        // a revalidating client asks for the file only if it changed since it last saw it
+        char cond[ETAG_LEN + 32] = "";
+        if (c->etags != NULL && c->etags[file][0] != '\0') {
+            snprintf(cond, sizeof(cond), "If-None-Match: %s\r\n", c->etags[file]);
+        }
+        len = snprintf(req, sizeof(req), "GET /bench%d.dat HTTP/1.1\r\n%s%s%s\r\n", file, cond,
+            accept_gzip ? "Accept-Encoding: gzip\r\n" : "", keep_alive ? "" : "Connection: close\r\n");
+    }
+
+    uint64_t t0 = now_ns();
+
+    uint64_t wire = 0;
+    char etag[ETAG_LEN] = "";
+    int status = -1;
+    for (int attempt = 0; attempt < 2 && status < 0; attempt++) {
+        // the server closes a kept-alive connection without a word once it hits its -k cap
+        // or idle timeout, so a request lost that way is sent once more on a fresh connection
+        if (attempt > 0) {
+            if (!reused) {
+                break;
+            }
+            close(c->fd);
+            c->fd = connect_server();
+            if (c->fd < 0) {
+                break;
+            }
+        }
+
+        bool sent = send_all(c->fd, req, (size_t) len)
+            && (!put || (chunk_size > 0 ? send_chunked(c->fd, body, size) : send_all(c->fd, body, size)));
+        status = sent ? recv_response(c->fd, &(c->bytes), &wire, etag) : -1;
+    }
+
+    hist_record(c->hist, now_ns() - t0);
+
+    if (put) {
+        c->puts += 1;
+        c->bytes += size;
+    }
+    else {
+        c->gets += 1;
+        c->get_wire += wire;
+    }
+
+    // a PUT changes the file, so its old validator is useless
+    if (c->etags != NULL && put) {
+        c->etags[file][0] = '\0';
+    }
+    else if (c->etags != NULL && status == 200) {
+        memcpy(c->etags[file], etag, ETAG_LEN);
+    }
+    if (status == 304) {
+        c->not_modified += 1;
+    }
+
+    if ((status >= 200 && status < 300) || status == 304) {
+        c->ok += 1;
+    }
+    else {
+        c->errors += 1;
+    }
+
+    // a failed connection, or one we asked the server to close, is not reused
+    if ((status < 0 || !keep_alive) && c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* client_exec(void* args) {
+
+    client_t* c = (client_t* ) args;
+
+    if (revalidate) {
+        c->etags = calloc(num_files, ETAG_LEN);
+    }
+
+    while (1) {
+        uint64_t now = now_ns();
+        if (now >= end_ns) {
+            break;
+        }
+
+        // in burst mode every client goes quiet together for the off part of each period
+        if (burst_off_ms > 0) {
+            uint64_t period = (uint64_t) (burst_on_ms + burst_off_ms) * 1000000ull;
+            uint64_t phase = (now - start_ns) % period;
+            if (phase >= (uint64_t) burst_on_ms * 1000000ull) {
+                uint64_t wait = period - phase;
+                struct timespec ts = { .tv_sec = (time_t) (wait / 1000000000ull), .tv_nsec = (long) (wait % 1000000000ull) };
+                nanosleep(&ts, NULL);
+                continue;
+            }
+        }
+
+        bool put = (int) (rng_next(&(c->rng)) % 100) < put_percent;
+        do_request(c, put, pick_file(&(c->rng)));
+    }
+
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    free(c->etags);
+
+    return args;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void hist_record(uint64_t* hist, uint64_t ns) {
+
+    // bucket by the top SUB_BITS + 1 significant bits of the value
+    int bucket;
+    if (ns < SUB_BUCKETS) {
+        bucket = (int) ns;
+    }
+    else {
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - SUB_BITS;
+        bucket = (shift + 1) * SUB_BUCKETS + (int) ((ns >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    if (bucket >= HIST_BUCKETS) {
+        bucket = HIST_BUCKETS - 1;
+    }
+    hist[bucket] += 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t hist_percentile(uint64_t* hist, uint64_t count, double q) {
+
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) ceil(q * (double) count);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= rank) {
+            // report the upper edge of the bucket
+            if (b < SUB_BUCKETS) {
+                return (uint64_t) b;
+            }
+            int shift = b / SUB_BUCKETS - 1;
+            uint64_t base = (uint64_t) (SUB_BUCKETS + b % SUB_BUCKETS) << shift;
+            return base + ((1ull << shift) - 1);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include "../rwlock.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "usage: %s [-n ops_per_thread] [-t max_threads] [-s seed]\n"
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                   STRUCTS
+//-----------------------------------------------------------------------------------------------------------------
+
+struct thread_arguments {
+    int tid;
+    int write_percent;
+    bool pthread;
+};
+
+typedef struct thread_arguments thread_arguments_t;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+int ops = 100000;
+int max_threads = 16;
+uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+const int write_percents[] = { 0, 1, 10, 50, 100 };
+const char* priority_names[] = { "READERS", "WRITERS", "N_WAY" };
+
+rwlock_t* lock_bench;
+pthread_rwlock_t pthread_bench;
+
+// written under the writer lock and read under the reader lock, so the critical sections are not empty
+uint64_t shared_counter;
+
+pthread_barrier_t start_barrier;
+atomic_ulong checksum;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int, char** );
+
+uint64_t now_ns(void );
+uint64_t rng_next(uint64_t* );
+
+double run(PRIORITY, int, int, bool );
+void* bench_exec(void* );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    MAIN
+//-----------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+
+    get_args(argc, argv);
+
+    printf("ops per thread: %d\n", ops);
+    printf("%-8s %7s %8s %14s %14s %8s\n", "priority", "write%", "threads", "rwlock ns/op", "pthread ns/op",
+        "speedup");
+
+    // pthread_rwlock_t has no priorities, it is timed again next to each for comparison
+    for (int p = READERS; p <= N_WAY; p++) {
+        for (size_t w = 0; w < sizeof(write_percents) / sizeof(write_percents[0]); w++) {
+            for (int threads = 1; threads <= max_threads; threads *= 4) {
+                double ours = run((PRIORITY) p, write_percents[w], threads, false);
+                double theirs = run((PRIORITY) p, write_percents[w], threads, true);
+                printf("%-8s %7d %8d %14.1f %14.1f %7.1fx\n", priority_names[p], write_percents[w], threads, ours,
+                    theirs, theirs / ours);
+            }
+        }
+    }
+    printf("checksum: %lu\n", atomic_load(&checksum));
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                ops = atoi(optarg);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10) | 1;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind != argc || ops < 1 || max_threads < 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t rng_next(uint64_t* state) {
+
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+double run(PRIORITY p, int write_percent, int threads, bool pthread) {
+
+    // n = 1 for N_WAY, as the server's per-uri locks use
+    if (pthread) {
+        pthread_rwlock_init(&pthread_bench, NULL);
+    }
+    else {
+        lock_bench = rwlock_new(p, 1);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    pthread_t* tids = (pthread_t* ) malloc(sizeof(pthread_t) * threads);
+    thread_arguments_t* args = (thread_arguments_t* ) malloc(sizeof(thread_arguments_t) * threads);
+
+    for (int i = 0; i < threads; i++) {
+        args[i].tid = i;
+        args[i].write_percent = write_percent;
+        args[i].pthread = pthread;
+        pthread_create(&tids[i], NULL, bench_exec, &args[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    pthread_barrier_destroy(&start_barrier);
+    free(tids);
+    free(args);
+
+    if (pthread) {
+        pthread_rwlock_destroy(&pthread_bench);
+    }
+    else {
+        rwlock_delete(&lock_bench);
+    }
+
+    // wall time of one lock and unlock on each thread, with one thread it is the uncontended fast path
+    return (double) elapsed / ops;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* bench_exec(void* args) {
+
+    thread_arguments_t* props = (thread_arguments_t* ) args;
+    uint64_t state = seed ^ ((uint64_t) (props->tid + 1) * 0x9e3779b97f4a7c15ull);
+    uint64_t sum = 0;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (int i = 0; i < ops; i++) {
+        bool write = (int) (rng_next(&state) % 100) < props->write_percent;
+
+        if (props->pthread) {
+            if (write) {
+                pthread_rwlock_wrlock(&pthread_bench);
+                shared_counter++;
+            }
+            else {
+                pthread_rwlock_rdlock(&pthread_bench);
+                sum += shared_counter;
+            }
+            pthread_rwlock_unlock(&pthread_bench);
+        }
+        else if (write) {
+            writer_lock(lock_bench);
+            shared_counter++;
+            writer_unlock(lock_bench);
+        }
+        else {
+            reader_lock(lock_bench);
+            sum += shared_counter;
+            reader_unlock(lock_bench);
+        }
+    }
+
+    atomic_fetch_add_explicit(&checksum, sum, memory_order_relaxed);
+
+    return NULL;
+}
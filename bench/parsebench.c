@@ -0,0 +1,344 @@
+#include "../parser.h"
+
+#include <ctype.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "usage: %s [-n requests] [-r rounds] [-m mutate_percent] [-s seed]\n"
+
+// the request line and header line patterns conn_parse matches, built from protocol.h
+#define LINE_REGEX  "^(" TYPE_REGEX ") (" URI_REGEX ") (" HTTP_REGEX ")\r\n"
+#define FIELD_REGEX "^(" HEADER_FIELD_REGEX "): (" HEADER_VALUE_REGEX ")\r\n"
+
+// room for a head past MAX_HEADER_LEN, so over-long requests are in the corpus too
+#define REQUEST_BUF (2 * MAX_HEADER_LEN)
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                   STRUCTS
+//-----------------------------------------------------------------------------------------------------------------
+
+struct request {
+    char* buf;
+    size_t len;
+};
+
+typedef struct request request_t;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+int num_requests = 10000;
+int rounds = 3;
+int mutate_percent = 30;
+uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+regex_t line_re;
+regex_t field_re;
+
+request_t* corpus;
+size_t corpus_bytes;
+
+const char* names[] = { "Content-Length", "Request-Id", "Connection", "Range", "If-None-Match",
+    "If-Modified-Since", "Transfer-Encoding", "Accept-Encoding", "Host", "User-Agent", "Accept", "X-Forwarded-For" };
+
+const char alpha_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+const char token_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-";
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int, char** );
+
+uint64_t now_ns(void );
+uint64_t rng_next(uint64_t* );
+size_t rng_range(uint64_t*, size_t, size_t );
+
+size_t append_run(char*, size_t, uint64_t*, const char*, size_t );
+void corpus_init(void );
+
+ssize_t regex_parse(const char*, size_t, parser_request_t* );
+bool same_request(const char*, ssize_t, const parser_request_t*, ssize_t, const parser_request_t* );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    MAIN
+//-----------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+
+    get_args(argc, argv);
+
+    if (regcomp(&line_re, LINE_REGEX, REG_EXTENDED) != 0 || regcomp(&field_re, FIELD_REGEX, REG_EXTENDED) != 0) {
+        fprintf(stderr, "cannot compile the protocol.h regular expressions\n");
+        exit(1);
+    }
+
+    corpus_init();
+
+    // both parsers must agree on every request before either is timed
+    parser_request_t* fast = (parser_request_t* ) malloc(sizeof(parser_request_t));
+    parser_request_t* slow = (parser_request_t* ) malloc(sizeof(parser_request_t));
+    int valid = 0;
+    int mismatches = 0;
+    for (int i = 0; i < num_requests; i++) {
+        ssize_t a = parser_parse(corpus[i].buf, corpus[i].len, fast);
+        ssize_t b = regex_parse(corpus[i].buf, corpus[i].len, slow);
+        valid += b > 0;
+        if (!same_request(corpus[i].buf, a, fast, b, slow)) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "mismatch on request %d: parser %zd, regex %zd\n%.*s\n", i, a, b,
+                    (int) corpus[i].len, corpus[i].buf);
+            }
+        }
+    }
+
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < num_requests; i++) {
+            sum += (uint64_t) parser_parse(corpus[i].buf, corpus[i].len, fast);
+        }
+    }
+    uint64_t fast_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < num_requests; i++) {
+            sum += (uint64_t) regex_parse(corpus[i].buf, corpus[i].len, slow);
+        }
+    }
+    uint64_t slow_ns = now_ns() - start;
+
+    double parses = (double) num_requests * rounds;
+    double mib = (double) corpus_bytes * rounds / (1024.0 * 1024.0);
+
+    printf("requests: %d (%d valid, %d mutated away), %.1f KiB, rounds: %d, checksum: %lu\n", num_requests, valid,
+        num_requests - valid, (double) corpus_bytes / 1024.0, rounds, (unsigned long) sum);
+    printf("parser_parse: %.1f ns/request, %.1f MiB/s\n", (double) fast_ns / parses, mib / ((double) fast_ns / 1e9));
+    printf("regex:        %.1f ns/request, %.1f MiB/s\n", (double) slow_ns / parses, mib / ((double) slow_ns / 1e9));
+    printf("speedup: %.1fx, mismatches: %d\n", (double) slow_ns / (double) fast_ns, mismatches);
+
+    for (int i = 0; i < num_requests; i++) {
+        free(corpus[i].buf);
+    }
+    free(corpus);
+    free(fast);
+    free(slow);
+    regfree(&line_re);
+    regfree(&field_re);
+
+    return mismatches > 0 ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:m:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                num_requests = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'm':
+                mutate_percent = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10) | 1;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind != argc || num_requests < 1 || rounds < 1 || mutate_percent < 0 || mutate_percent > 100) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t rng_next(uint64_t* state) {
+
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+size_t rng_range(uint64_t* state, size_t min, size_t max) {
+
+    return min + (size_t) (rng_next(state) % (max - min + 1));
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+size_t append_run(char* buf, size_t off, uint64_t* state, const char* chars, size_t len) {
+
+    // a run of len random characters out of chars, or of printable ASCII if chars is NULL
+    for (size_t i = 0; i < len && off < REQUEST_BUF; i++) {
+        buf[off++] = chars ? chars[rng_next(state) % strlen(chars)] : (char) rng_range(state, ' ', '~');
+    }
+
+    return off;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void corpus_init(void) {
+
+    corpus = (request_t* ) calloc(num_requests, sizeof(request_t));
+
+    uint64_t state = seed;
+    for (int i = 0; i < num_requests; i++) {
+        // one byte more than the buffer the request is built in, regexec needs the terminating NUL
+        char* buf = (char* ) calloc(REQUEST_BUF + 1, 1);
+        size_t off = 0;
+
+        // lengths reach one past each limit now and then, so both sides of every bound are covered
+        off = append_run(buf, off, &state, alpha_chars, rng_next(&state) % 8 == 0 ? 9 : rng_range(&state, 1, 8));
+        off += (size_t) snprintf(buf + off, REQUEST_BUF - off, " /");
+        off = append_run(buf, off, &state, token_chars, rng_next(&state) % 8 == 0 ? 64 : rng_range(&state, 1, 63));
+        off += (size_t) snprintf(buf + off, REQUEST_BUF - off, " HTTP/1.%d\r\n", (int) (rng_next(&state) % 2));
+
+        // a few requests carry enough fields to go past MAX_HEADER_LEN
+        size_t fields = rng_next(&state) % 20 == 0 ? rng_range(&state, 10, 30) : rng_range(&state, 0, 8);
+        for (size_t f = 0; f < fields && off + 300 < REQUEST_BUF; f++) {
+            if (rng_next(&state) % 4 == 0) {
+                off = append_run(buf, off, &state, token_chars, rng_range(&state, 1, 129));
+            } else {
+                off += (size_t) snprintf(buf + off, REQUEST_BUF - off, "%s",
+                    names[rng_next(&state) % (sizeof(names) / sizeof(names[0]))]);
+            }
+            off += (size_t) snprintf(buf + off, REQUEST_BUF - off, ": ");
+            off = append_run(buf, off, &state, NULL, rng_next(&state) % 3 == 0 ? rng_range(&state, 1, 129)
+                                                                               : rng_range(&state, 1, 24));
+            off += (size_t) snprintf(buf + off, REQUEST_BUF - off, "\r\n");
+        }
+        off += (size_t) snprintf(buf + off, REQUEST_BUF - off, "\r\n");
+
+        // corrupt a byte, drop a byte, or cut the request short
+        if ((int) (rng_next(&state) % 100) < mutate_percent) {
+            size_t at = (size_t) (rng_next(&state) % off);
+            switch (rng_next(&state) % 3) {
+                case 0:
+                    buf[at] = (char) rng_range(&state, 1, 255);
+                    break;
+                case 1:
+                    memmove(buf + at, buf + at + 1, off - at - 1);
+                    off--;
+                    break;
+                default:
+                    off = at;
+                    break;
+            }
+            buf[off] = '\0';
+        }
+
+        corpus[i].buf = buf;
+        corpus[i].len = off;
+        corpus_bytes += off;
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t regex_parse(const char* buf, size_t len, parser_request_t* req) {
+
+    // a request is complete here, so a head that does not end within buf is as bad as a malformed one
+    (void) len;
+
+    regmatch_t m[4];
+    if (regexec(&line_re, buf, 4, m, 0) != 0) {
+        return -1;
+    }
+    req->method = (uint16_t) m[1].rm_so;
+    req->method_len = (uint8_t) (m[1].rm_eo - m[1].rm_so);
+    req->uri = (uint16_t) (m[2].rm_so + 1);
+    req->uri_len = (uint8_t) (m[2].rm_eo - m[2].rm_so - 1);
+    req->version = (uint16_t) m[3].rm_so;
+    req->num_fields = 0;
+
+    size_t off = (size_t) m[0].rm_eo;
+    while (off <= MAX_HEADER_LEN) {
+        if (buf[off] == '\r' && buf[off + 1] == '\n') {
+            return off + 2 <= MAX_HEADER_LEN ? (ssize_t) (off + 2) : -1;
+        }
+        if (req->num_fields == PARSER_MAX_FIELDS || regexec(&field_re, buf + off, 3, m, 0) != 0) {
+            return -1;
+        }
+
+        parser_field_t* f = &(req->fields[req->num_fields++]);
+        f->name = (uint16_t) (off + (size_t) m[1].rm_so);
+        f->name_len = (uint8_t) (m[1].rm_eo - m[1].rm_so);
+        f->value = (uint16_t) (off + (size_t) m[2].rm_so);
+        f->value_len = (uint8_t) (m[2].rm_eo - m[2].rm_so);
+        off += (size_t) m[0].rm_eo;
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool same_request(const char* buf, ssize_t a, const parser_request_t* x, ssize_t b, const parser_request_t* y) {
+
+    // parser_parse says 0 for a head cut short, which is a reject for a request that is all there
+    if (a <= 0 || b <= 0) {
+        return a <= 0 && b <= 0;
+    }
+    if (a != b || x->method_len != y->method_len || x->uri != y->uri || x->uri_len != y->uri_len
+        || x->version != y->version || x->num_fields != y->num_fields) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < x->num_fields; i++) {
+        const parser_field_t* f = &(x->fields[i]);
+        const parser_field_t* g = &(y->fields[i]);
+        if (f->name != g->name || f->name_len != g->name_len || f->value != g->value || f->value_len != g->value_len) {
+            return false;
+        }
+    }
+
+    // parser_find returns the first field of a name, in whatever case it was sent
+    for (uint16_t i = 0; i < x->num_fields; i++) {
+        const parser_field_t* f = &(x->fields[i]);
+        char name[UINT8_MAX + 1];
+        for (uint8_t j = 0; j < f->name_len; j++) {
+            name[j] = (char) (j % 2 ? tolower(buf[f->name + j]) : toupper(buf[f->name + j]));
+        }
+        name[f->name_len] = '\0';
+
+        const parser_field_t* found = parser_find(x, buf, name);
+        if (found == NULL || found > f || found->name_len != f->name_len
+            || strncasecmp(buf + found->name, name, f->name_len) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
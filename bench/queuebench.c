@@ -0,0 +1,300 @@
+#include "../queue.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "usage: %s [-n items] [-p producers] [-c max_consumers] [-q queue_depth]\n"
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                   STRUCTS
+//-----------------------------------------------------------------------------------------------------------------
+
+// the queue before the lock-free ring: pointers in a ring guarded by three semaphores
+struct old_queue {
+    void** buf;
+    int n, in, out;
+
+    sem_t mutex;
+    sem_t empty_sem;
+    sem_t full_sem;
+};
+
+// what the server queues for each connection
+struct job {
+    int connfd;
+    int served;
+    uint64_t enqueued_ns;
+};
+
+struct thread_arguments {
+    int tid;
+    int count;
+};
+
+typedef struct old_queue old_queue_t;
+typedef struct job job_t;
+typedef struct thread_arguments thread_arguments_t;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+int num_items = 1000000;
+int producers = 1;
+int max_consumers = 64;
+int queue_depth = 1024;
+
+bool use_old;
+queue_t* queue_bench;
+old_queue_t* old_bench;
+
+// the old queue carries pointers, so every item it moves lives here
+job_t* items;
+
+pthread_barrier_t start_barrier;
+atomic_ulong checksum;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int, char** );
+
+uint64_t now_ns(void );
+
+old_queue_t* old_queue_new(int );
+void old_queue_delete(old_queue_t* );
+void old_queue_push(old_queue_t*, void* );
+void* old_queue_pop(old_queue_t* );
+
+double run(int, bool );
+void* producer_exec(void* );
+void* consumer_exec(void* );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    MAIN
+//-----------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+
+    get_args(argc, argv);
+
+    items = (job_t* ) calloc(num_items, sizeof(job_t));
+    for (int i = 0; i < num_items; i++) {
+        items[i].connfd = i;
+    }
+
+    printf("items: %d, producers: %d, queue depth: %d\n", num_items, producers, queue_depth);
+    printf("%10s %16s %16s %8s\n", "consumers", "ring Mops/s", "semaphore Mops/s", "speedup");
+
+    for (int consumers = 1; consumers <= max_consumers; consumers *= 2) {
+        double ring = run(consumers, false);
+        double old = run(consumers, true);
+        printf("%10d %16.2f %16.2f %7.1fx\n", consumers, ring, old, ring / old);
+    }
+    printf("checksum: %lu\n", atomic_load(&checksum));
+
+    free(items);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:c:q:")) != -1) {
+        switch (opt) {
+            case 'n':
+                num_items = atoi(optarg);
+                break;
+            case 'p':
+                producers = atoi(optarg);
+                break;
+            case 'c':
+                max_consumers = atoi(optarg);
+                break;
+            case 'q':
+                queue_depth = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind != argc || num_items < 1 || producers < 1 || max_consumers < 1 || queue_depth < 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+old_queue_t* old_queue_new(int size) {
+
+    old_queue_t* q = (old_queue_t* ) malloc(sizeof(old_queue_t));
+    q->buf = (void** ) malloc(size * sizeof(void* ));
+    q->n = size;
+    q->in = 0;
+    q->out = 0;
+
+    sem_init(&(q->mutex), 0, 1);
+    sem_init(&(q->empty_sem), 0, 0);
+    sem_init(&(q->full_sem), 0, size);
+
+    return q;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void old_queue_delete(old_queue_t* q) {
+
+    sem_destroy(&(q->mutex));
+    sem_destroy(&(q->empty_sem));
+    sem_destroy(&(q->full_sem));
+    free(q->buf);
+    free(q);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void old_queue_push(old_queue_t* q, void* elem) {
+
+    sem_wait(&(q->full_sem));
+    sem_wait(&(q->mutex));
+
+    q->buf[q->in] = elem;
+    q->in = (q->in + 1) % q->n;
+
+    sem_post(&(q->mutex));
+    sem_post(&(q->empty_sem));
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* old_queue_pop(old_queue_t* q) {
+
+    sem_wait(&(q->empty_sem));
+    sem_wait(&(q->mutex));
+
+    void* elem = q->buf[q->out];
+    q->buf[q->out] = NULL;
+    q->out = (q->out + 1) % q->n;
+
+    sem_post(&(q->mutex));
+    sem_post(&(q->full_sem));
+
+    return elem;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+double run(int consumers, bool old) {
+
+    use_old = old;
+    if (old) {
+        old_bench = old_queue_new(queue_depth);
+    }
+    else {
+        queue_bench = queue_new(queue_depth, sizeof(job_t));
+    }
+
+    int threads = producers + consumers;
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    pthread_t* tids = (pthread_t* ) malloc(sizeof(pthread_t) * threads);
+    thread_arguments_t* args = (thread_arguments_t* ) malloc(sizeof(thread_arguments_t) * threads);
+
+    // items are split evenly among the producers, and again among the consumers
+    for (int i = 0; i < threads; i++) {
+        bool producer = i < producers;
+        int id = producer ? i : i - producers;
+        int share = producer ? producers : consumers;
+        args[i].tid = id;
+        args[i].count = num_items / share + (id < num_items % share);
+        pthread_create(&tids[i], NULL, producer ? producer_exec : consumer_exec, &args[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    pthread_barrier_destroy(&start_barrier);
+    free(tids);
+    free(args);
+
+    if (old) {
+        old_queue_delete(old_bench);
+    }
+    else {
+        queue_delete(&queue_bench);
+    }
+
+    // a push and its pop make one op
+    return (double) num_items * 1000.0 / (double) elapsed;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* producer_exec(void* args) {
+
+    thread_arguments_t* props = (thread_arguments_t* ) args;
+
+    pthread_barrier_wait(&start_barrier);
+
+    // producer i pushes items i, i + producers, ...
+    for (int i = 0; i < props->count; i++) {
+        job_t* job = &items[props->tid + i * producers];
+        job->enqueued_ns = (uint64_t) i;
+        if (use_old) {
+            old_queue_push(old_bench, job);
+        }
+        else {
+            queue_push(queue_bench, job);
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* consumer_exec(void* args) {
+
+    thread_arguments_t* props = (thread_arguments_t* ) args;
+    uint64_t sum = 0;
+
+    pthread_barrier_wait(&start_barrier);
+
+    // every consumer pops a fixed share, so the run ends without stop items
+    for (int i = 0; i < props->count; i++) {
+        job_t job;
+        if (use_old) {
+            job = *(job_t* ) old_queue_pop(old_bench);
+        }
+        else {
+            queue_pop(queue_bench, &job);
+        }
+        sum += (uint64_t) job.connfd;
+    }
+
+    atomic_fetch_add_explicit(&checksum, sum, memory_order_relaxed);
+
+    return NULL;
+}
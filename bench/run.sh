@@ -0,0 +1,22 @@
+#!/bin/sh
+# Starts httpserver in a scratch directory, drives it over loopback with
+# loadgen, and stops it again.
+#
+# usage: bench/run.sh <port> "<httpserver options>" "<loadgen options>"
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=$1
+server_args=$2
+loadgen_args=$3
+
+dir=$(mktemp -d)
+cd "$dir"
+
+# the audit log would only measure the terminal, an explicit -l in the options still wins
+"$root/httpserver" -l /dev/null $server_args "$port" &
+pid=$!
+trap 'kill $pid 2>/dev/null; wait $pid 2>/dev/null || true; rm -rf "$dir"' EXIT
+
+"$root/bench/loadgen" $loadgen_args 127.0.0.1 "$port"
@@ -0,0 +1,300 @@
+#include "../slots.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "usage: %s [-n ops_per_thread] [-u uris] [-t max_threads] [-s seed]\n"
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                   STRUCTS
+//-----------------------------------------------------------------------------------------------------------------
+
+// the table before the sharded one: one slot per worker, found by a linear scan under one mutex
+struct old_slot {
+    char* uri;
+    rwlock_t* lock;
+    int num_workers;
+};
+
+struct old_table {
+    pthread_mutex_t mutex;
+    struct old_slot* slots;
+    int n;
+};
+
+struct thread_arguments {
+    int tid;
+    bool old;
+};
+
+typedef struct old_slot old_slot_t;
+typedef struct old_table old_table_t;
+typedef struct thread_arguments thread_arguments_t;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+int ops = 200000;
+int num_uris = 256;
+int max_threads = 128;
+uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+char (*uris)[MAX_URI_LEN];
+
+slots_t* table_new;
+old_table_t* table_old;
+
+pthread_barrier_t start_barrier;
+atomic_ulong checksum;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int, char** );
+
+uint64_t now_ns(void );
+uint64_t rng_next(uint64_t* );
+
+old_table_t* old_new(int );
+void old_delete(old_table_t* );
+int old_enter(old_table_t*, const char* );
+void old_leave(old_table_t*, int );
+
+double run(int, bool );
+void* bench_exec(void* );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    MAIN
+//-----------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+
+    get_args(argc, argv);
+
+    // uris the server would accept, so both tables hash and compare what they would in production
+    uris = (char (*)[MAX_URI_LEN]) malloc(sizeof(*uris) * num_uris);
+    for (int i = 0; i < num_uris; i++) {
+        snprintf(uris[i], MAX_URI_LEN, "file-%d.txt", i);
+    }
+
+    printf("ops per thread: %d, uris: %d\n", ops, num_uris);
+    printf("%8s %16s %16s %16s %16s %8s\n", "threads", "sharded ns/op", "sharded Mops/s", "linear ns/op",
+        "linear Mops/s", "speedup");
+
+    for (int threads = 4; threads <= max_threads; threads *= 2) {
+        double sharded = run(threads, false);
+        double linear = run(threads, true);
+        printf("%8d %16.1f %16.2f %16.1f %16.2f %7.1fx\n", threads, sharded, threads * 1000.0 / sharded, linear,
+            threads * 1000.0 / linear, linear / sharded);
+    }
+    printf("checksum: %lu\n", atomic_load(&checksum));
+
+    free(uris);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:t:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                ops = atoi(optarg);
+                break;
+            case 'u':
+                num_uris = atoi(optarg);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10) | 1;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind != argc || ops < 1 || num_uris < 1 || max_threads < 4) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t rng_next(uint64_t* state) {
+
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+old_table_t* old_new(int n) {
+
+    old_table_t* t = (old_table_t* ) malloc(sizeof(old_table_t));
+    pthread_mutex_init(&(t->mutex), NULL);
+    t->slots = (old_slot_t* ) calloc(n, sizeof(old_slot_t));
+    t->n = n;
+
+    for (int i = 0; i < n; i++) {
+        t->slots[i].uri = strdup("");
+    }
+
+    return t;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void old_delete(old_table_t* t) {
+
+    for (int i = 0; i < t->n; i++) {
+        free(t->slots[i].uri);
+    }
+    free(t->slots);
+    pthread_mutex_destroy(&(t->mutex));
+    free(t);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int old_enter(old_table_t* t, const char* uri) {
+
+    // the original scans ran outside the mutex and raced, here both run under it
+    pthread_mutex_lock(&(t->mutex));
+
+    int found = -1;
+    for (int i = 0; i < t->n && found < 0; i++) {
+        if (strcmp(t->slots[i].uri, uri) == 0 && t->slots[i].uri[0] != '\0') {
+            found = i;
+        }
+    }
+
+    // an unused slot gets a fresh uri copy and a fresh lock, as slot_create did
+    for (int i = 0; i < t->n && found < 0; i++) {
+        if (t->slots[i].uri[0] == '\0') {
+            free(t->slots[i].uri);
+            t->slots[i].uri = strdup(uri);
+            t->slots[i].lock = rwlock_new(N_WAY, 1);
+            found = i;
+        }
+    }
+
+    t->slots[found].num_workers += 1;
+    pthread_mutex_unlock(&(t->mutex));
+
+    return found;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void old_leave(old_table_t* t, int n) {
+
+    pthread_mutex_lock(&(t->mutex));
+    t->slots[n].num_workers -= 1;
+
+    if (t->slots[n].num_workers == 0) {
+        rwlock_delete(&(t->slots[n].lock));
+        t->slots[n].uri[0] = '\0';
+    }
+
+    pthread_mutex_unlock(&(t->mutex));
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+double run(int threads, bool old) {
+
+    // one slot per thread, as the server sizes the table for its pool
+    if (old) {
+        table_old = old_new(threads);
+    }
+    else {
+        table_new = slots_new(threads, false);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    pthread_t* tids = (pthread_t* ) malloc(sizeof(pthread_t) * threads);
+    thread_arguments_t* args = (thread_arguments_t* ) malloc(sizeof(thread_arguments_t) * threads);
+
+    for (int i = 0; i < threads; i++) {
+        args[i].tid = i;
+        args[i].old = old;
+        pthread_create(&tids[i], NULL, bench_exec, &args[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    pthread_barrier_destroy(&start_barrier);
+    free(tids);
+    free(args);
+
+    if (old) {
+        old_delete(table_old);
+    }
+    else {
+        slots_delete(&table_new);
+    }
+
+    // wall time of one enter and leave on each thread
+    return (double) elapsed / ops;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* bench_exec(void* args) {
+
+    thread_arguments_t* props = (thread_arguments_t* ) args;
+    uint64_t state = seed ^ ((uint64_t) (props->tid + 1) * 0x9e3779b97f4a7c15ull);
+    uint64_t sum = 0;
+
+    pthread_barrier_wait(&start_barrier);
+
+    // each request joins the slot of a uniformly chosen uri and leaves it right away
+    for (int i = 0; i < ops; i++) {
+        const char* uri = uris[rng_next(&state) % num_uris];
+        if (props->old) {
+            int n = old_enter(table_old, uri);
+            sum += n;
+            old_leave(table_old, n);
+        }
+        else {
+            slot_t* slot = slots_enter(table_new, uri);
+            sum += (uintptr_t) slot_get_lock(slot) & 0xff;
+            slots_leave(table_new, slot);
+        }
+    }
+
+    atomic_fetch_add_explicit(&checksum, sum, memory_order_relaxed);
+
+    return NULL;
+}
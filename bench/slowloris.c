@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "usage: %s [-c connections] [-d seconds] [-H] <host> <port>\n"
+
+// the start of a request whose header never ends
+#define PARTIAL_HEAD "GET /slowloris.txt HTTP/1.1\r\nHost: bench\r\n"
+
+// what a trickling connection adds every second
+#define TRICKLE_LINE "X-Slow: 1\r\n"
+
+// how long a probe waits for its answer before it counts as failed
+#define PROBE_TIMEOUT_S 5
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+struct sockaddr_in server_addr;
+
+int connections = 64;
+int duration_s = 5;
+bool half_close = false;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int, char** );
+
+uint64_t now_ns(void );
+
+int connect_server(void );
+bool send_all(int, const char*, size_t );
+bool closed_by_server(int );
+bool probe(uint64_t* );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    MAIN
+//-----------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+
+    get_args(argc, argv);
+
+    // every connection sends the start of a header and then either trickles more
+    // lines or shuts down its side, in neither case does the header ever end
+    int* fds = (int* ) malloc(sizeof(int) * connections);
+    int open = 0;
+    for (int i = 0; i < connections; i++) {
+        fds[i] = connect_server();
+        if (fds[i] < 0 || !send_all(fds[i], PARTIAL_HEAD, strlen(PARTIAL_HEAD))) {
+            fprintf(stderr, "cannot open connection %d\n", i);
+            exit(1);
+        }
+        if (half_close) {
+            shutdown(fds[i], SHUT_WR);
+        }
+        open++;
+    }
+
+    // a probe a second shows whether the server still answers everyone else
+    int probes = 0;
+    int probes_ok = 0;
+    uint64_t probe_max = 0;
+    uint64_t start = now_ns();
+    uint64_t first_closed = 0;
+
+    for (int s = 0; s < duration_s; s++) {
+        sleep(1);
+
+        for (int i = 0; i < connections; i++) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            bool gone = closed_by_server(fds[i]);
+            if (!gone && !half_close) {
+                gone = !send_all(fds[i], TRICKLE_LINE, strlen(TRICKLE_LINE));
+            }
+            if (gone) {
+                close(fds[i]);
+                fds[i] = -1;
+                open--;
+                if (first_closed == 0) {
+                    first_closed = now_ns() - start;
+                }
+            }
+        }
+
+        uint64_t latency;
+        probes++;
+        if (probe(&latency)) {
+            probes_ok++;
+            probe_max = latency > probe_max ? latency : probe_max;
+        }
+    }
+
+    printf("connections: %d, %s, duration: %ds\n", connections, half_close ? "half-closed" : "trickling",
+        duration_s);
+    printf("closed by the server: %d", connections - open);
+    if (first_closed > 0) {
+        printf(", first within %.1fs", (double) first_closed / 1e9);
+    }
+    printf("\nprobes answered: %d of %d, max latency %.1fms\n", probes_ok, probes, (double) probe_max / 1e6);
+
+    for (int i = 0; i < connections; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(fds);
+
+    return probes_ok == probes ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void get_args(int argc, char** argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:H")) != -1) {
+        switch (opt) {
+            case 'c':
+                connections = atoi(optarg);
+                break;
+            case 'd':
+                duration_s = atoi(optarg);
+                break;
+            case 'H':
+                half_close = true;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind != argc - 2 || connections < 1 || duration_s < 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons((uint16_t) atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid host: %s\n", argv[optind]);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int connect_server(void) {
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct timeval tv = { .tv_sec = PROBE_TIMEOUT_S, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, (struct sockaddr* ) &server_addr, sizeof(server_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool send_all(int fd, const char* buf, size_t n) {
+
+    for (size_t off = 0; off < n; ) {
+        ssize_t sent = send(fd, buf + off, n - off, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        off += (size_t) sent;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool closed_by_server(int fd) {
+
+    // the server never answers a header that has not ended, so any readable byte
+    // or EOF means it gave up on the connection
+    char byte;
+    ssize_t n = recv(fd, &byte, 1, MSG_DONTWAIT);
+
+    return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool probe(uint64_t* latency) {
+
+    uint64_t start = now_ns();
+    int fd = connect_server();
+    if (fd < 0) {
+        return false;
+    }
+
+    // any status line will do, the file may not exist
+    char req[] = "GET /slowloris.txt HTTP/1.1\r\nConnection: close\r\n\r\n";
+    char buf[16];
+    bool ok = send_all(fd, req, strlen(req)) && recv(fd, buf, sizeof(buf), MSG_WAITALL) == (ssize_t) sizeof(buf)
+        && memcmp(buf, "HTTP/1.1 ", 9) == 0;
+    close(fd);
+
+    *latency = now_ns() - start;
+    return ok;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Starts httpserver in reactor mode, holds connections open with request
+# heads that never end, once trickling header lines and once shut down
+# after the first lines, and checks that the server keeps answering other
+# clients without spending the CPU on the stalled ones. Fails if a probe
+# goes unanswered or the server uses more than max_cpu percent of a CPU.
+#
+# usage: bench/slowloris.sh <port> "<httpserver options>" [connections] [seconds] [max_cpu]
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+. "$root/bench/lib.sh"
+
+port=$1
+server_args=$2
+connections=${3:-64}
+seconds=${4:-5}
+max_cpu=${5:-10}
+
+status=0
+for mode in "" "-H"; do
+    server_start "$port" -e $server_args
+
+    before=$(server_ticks)
+    "$root/bench/slowloris" -c "$connections" -d "$seconds" $mode 127.0.0.1 "$port" || status=1
+    cpu=$(cpu_percent "$before" "$(server_ticks)" "$seconds")
+
+    if awk -v c="$cpu" -v m="$max_cpu" 'BEGIN { exit !(c > m) }'; then
+        echo "server cpu: $cpu% (max $max_cpu%)  FAIL"
+        status=1
+    else
+        echo "server cpu: $cpu% (max $max_cpu%)"
+    fi
+    echo
+
+    server_stop
+done
+
+exit $status
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Starts httpserver in a scratch directory with bench/syscount.so preloaded,
+# sends it GETs and PUTs of one file over a keep-alive connection with curl,
+# and checks the file system calls each request made against the most it
+# should need. Fails if any request type needs more.
+#
+# usage: bench/syscalls.sh <port> [requests]
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=$1
+requests=${2:-200}
+
+dir=$(mktemp -d)
+log=$(mktemp)
+cd "$dir"
+
+# no cache, so every GET goes to the file system
+SYSCOUNT_LOG="$log" LD_PRELOAD="$root/bench/syscount.so" "$root/httpserver" -t 4 -l /dev/null "$port" &
+pid=$!
+trap 'kill $pid 2>/dev/null; wait $pid 2>/dev/null || true; rm -rf "$dir" "$log"' EXIT
+
+tries=0
+until curl -s -o /dev/null "http://127.0.0.1:$port/"; do
+    tries=$((tries + 1))
+    if [ $tries -ge 50 ]; then
+        echo "httpserver did not start on port $port" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+# the same url requests times, curl sends them all over one connection
+urls() {
+    n=0
+    while [ $n -lt "$requests" ]; do
+        echo "http://127.0.0.1:$port/$1"
+        n=$((n + 1))
+    done
+}
+
+# runs a command that sends n requests and counts the calls the server logged
+# meanwhile, limits are the most calls of each kind one request may make,
+# openat counts as open
+check() {
+    label=$1
+    n=$2
+    limits=$3
+    shift 3
+
+    start=$(($(wc -l < "$log") + 1))
+    "$@" > /dev/null
+    tail -n +"$start" "$log" | awk -v label="$label" -v n="$n" -v limits="$limits" '
+        { count[$1 == "openat" ? "open" : $1]++ }
+        END {
+            ok = 1
+            line = sprintf("%-10s", label)
+            k = split(limits, l, " ")
+            for (i = 1; i <= k; i++) {
+                split(l[i], kv, "=")
+                c = count[kv[1]] + 0
+                line = line sprintf("  %s %.2f (max %d)", kv[1], c / n, kv[2])
+                if (c > kv[2] * n) {
+                    ok = 0
+                }
+            }
+            print line (ok ? "" : "  FAIL")
+            exit !ok
+        }'
+}
+
+echo "file system calls per request"
+
+check "PUT new" 1 "open=1 fstat=0 stat=1 lstat=0 access=0" curl -s -X PUT --data-binary hello "http://127.0.0.1:$port/file"
+check "PUT" "$requests" "open=1 fstat=0 stat=1 lstat=0 access=1" curl -s -X PUT --data-binary hello $(urls file)
+check "GET" "$requests" "open=1 fstat=1 stat=0 lstat=0 access=0" curl -s $(urls file)
+check "GET 404" "$requests" "open=1 fstat=0 stat=0 lstat=0 access=0" curl -s $(urls missing)
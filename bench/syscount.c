@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// LD_PRELOAD shim that appends one line per file system or socket I/O call of the program to
+// the file named by SYSCOUNT_LOG, "<call> <path or fd>", so a script can count calls per
+// request. Only calls made through the dynamic symbols are seen, which is every call httpserver
+// makes; io_uring_enter goes through syscall(2) and is logged under its own name.
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                              GLOBAL VARIABLES
+//-----------------------------------------------------------------------------------------------------------------
+
+int (*real_open)(const char*, int, ...);
+int (*real_openat)(int, const char*, int, ...);
+int (*real_fstat)(int, struct stat* );
+int (*real_stat)(const char*, struct stat* );
+int (*real_lstat)(const char*, struct stat* );
+int (*real_access)(const char*, int );
+ssize_t (*real_read)(int, void*, size_t );
+ssize_t (*real_write)(int, const void*, size_t );
+ssize_t (*real_pread)(int, void*, size_t, off_t );
+ssize_t (*real_recv)(int, void*, size_t, int );
+ssize_t (*real_send)(int, const void*, size_t, int );
+ssize_t (*real_sendfile)(int, int, off_t*, size_t );
+ssize_t (*real_splice)(int, loff_t*, int, loff_t*, size_t, unsigned int );
+int (*real_accept4)(int, __SOCKADDR_ARG, socklen_t*, int );
+int (*real_poll)(struct pollfd*, nfds_t, int );
+long (*real_syscall)(long, ...);
+
+int log_fd = -1;
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                        HELPER FUNCTIONS DECLARATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void note(const char*, const char*, int );
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                                    SETUP
+//-----------------------------------------------------------------------------------------------------------------
+
+__attribute__((constructor)) void syscount_init(void) {
+
+    // ISO C has no cast from dlsym's void* to a function pointer, so the pointers are written through
+    *(void** ) &real_open = dlsym(RTLD_NEXT, "open");
+    *(void** ) &real_openat = dlsym(RTLD_NEXT, "openat");
+    *(void** ) &real_fstat = dlsym(RTLD_NEXT, "fstat");
+    *(void** ) &real_stat = dlsym(RTLD_NEXT, "stat");
+    *(void** ) &real_lstat = dlsym(RTLD_NEXT, "lstat");
+    *(void** ) &real_access = dlsym(RTLD_NEXT, "access");
+    *(void** ) &real_read = dlsym(RTLD_NEXT, "read");
+    *(void** ) &real_write = dlsym(RTLD_NEXT, "write");
+    *(void** ) &real_pread = dlsym(RTLD_NEXT, "pread");
+    *(void** ) &real_recv = dlsym(RTLD_NEXT, "recv");
+    *(void** ) &real_send = dlsym(RTLD_NEXT, "send");
+    *(void** ) &real_sendfile = dlsym(RTLD_NEXT, "sendfile");
+    *(void** ) &real_splice = dlsym(RTLD_NEXT, "splice");
+    *(void** ) &real_accept4 = dlsym(RTLD_NEXT, "accept4");
+    *(void** ) &real_poll = dlsym(RTLD_NEXT, "poll");
+    *(void** ) &real_syscall = dlsym(RTLD_NEXT, "syscall");
+
+    // the log itself is opened before any call is noted, so it never shows up in the counts
+    char* path = getenv("SYSCOUNT_LOG");
+    if (path != NULL) {
+        log_fd = real_open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                               INTERPOSED CALLS
+//-----------------------------------------------------------------------------------------------------------------
+
+int open(const char* path, int flags, ...) {
+
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    note("open", path, -1);
+    return real_open(path, flags, mode);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int openat(int dirfd, const char* path, int flags, ...) {
+
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    note("openat", path, -1);
+    return real_openat(dirfd, path, flags, mode);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int fstat(int fd, struct stat* st) {
+
+    note("fstat", NULL, fd);
+    return real_fstat(fd, st);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int stat(const char* path, struct stat* st) {
+
+    note("stat", path, -1);
+    return real_stat(path, st);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int lstat(const char* path, struct stat* st) {
+
+    note("lstat", path, -1);
+    return real_lstat(path, st);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int access(const char* path, int mode) {
+
+    note("access", path, -1);
+    return real_access(path, mode);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t read(int fd, void* buf, size_t count) {
+
+    note("read", NULL, fd);
+    return real_read(fd, buf, count);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t write(int fd, const void* buf, size_t count) {
+
+    note("write", NULL, fd);
+    return real_write(fd, buf, count);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+
+    note("pread", NULL, fd);
+    return real_pread(fd, buf, count, offset);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t recv(int fd, void* buf, size_t len, int flags) {
+
+    note("recv", NULL, fd);
+    return real_recv(fd, buf, len, flags);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t send(int fd, const void* buf, size_t len, int flags) {
+
+    note("send", NULL, fd);
+    return real_send(fd, buf, len, flags);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+
+    note("sendfile", NULL, out_fd);
+    return real_sendfile(out_fd, in_fd, offset, count);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+ssize_t splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags) {
+
+    note("splice", NULL, fd_in);
+    return real_splice(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+// glibc declares the address as a transparent union under _GNU_SOURCE, the definition has to match
+int accept4(int fd, __SOCKADDR_ARG addr, socklen_t* addrlen, int flags) {
+
+    note("accept4", NULL, fd);
+    return real_accept4(fd, addr, addrlen, flags);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int poll(struct pollfd* fds, nfds_t nfds, int timeout) {
+
+    note("poll", NULL, (int) nfds);
+    return real_poll(fds, nfds, timeout);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+long syscall(long number, ...) {
+
+    // every syscall(2) argument is register sized, passing six is what glibc does too
+    long args[6];
+    va_list ap;
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++) {
+        args[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+
+    note(number == SYS_io_uring_enter ? "io_uring_enter" : "syscall", NULL, (int) args[0]);
+    return real_syscall(number, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+//                                     HELPER FUNCTIONS IMPLEMENTATIONS
+//-----------------------------------------------------------------------------------------------------------------
+
+void note(const char* call, const char* path, int fd) {
+
+    if (log_fd < 0) {
+        return;
+    }
+
+    // one write per line, O_APPEND keeps lines from different threads whole
+    char line[256];
+    int len = path != NULL ? snprintf(line, sizeof(line), "%s %s\n", call, path)
+                           : snprintf(line, sizeof(line), "%s %d\n", call, fd);
+    if (len > (int) sizeof(line) - 1) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    // the real write, the interposed one would note its own line
+    ssize_t put = real_write(log_fd, line, len);
+    (void) put;
+}
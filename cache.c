@@ -0,0 +1,257 @@
+#include "cache.h"
+#include "iowrapper.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct cache_entry {
+    char *uri;
+    uint32_t hash;
+
+    // header and body back to back, so a hit goes out in one write
+    char *data;
+    size_t header_len;
+    size_t body_len;
+
+    int refs;
+    bool referenced;
+    bool linked;
+
+    struct cache_entry *chain;
+    struct cache_entry *prev;
+    struct cache_entry *next;
+};
+
+struct cache {
+    size_t capacity;
+    size_t max_object;
+    size_t used;
+
+    pthread_mutex_t lock;
+
+    cache_entry_t **buckets;
+    uint32_t num_buckets;
+
+    // CLOCK ring, hand points at the next eviction candidate
+    cache_entry_t *hand;
+
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+};
+typedef struct cache cache_t;
+
+static uint32_t cache_hash(const char *uri) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) uri; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t entry_size(cache_entry_t *e) {
+    return e->header_len + e->body_len;
+}
+
+static void entry_free(cache_entry_t *e) {
+    free(e->uri);
+    free(e->data);
+    free(e);
+}
+
+// remove e from the table and the ring, freeing it once nobody holds it
+static void entry_unlink(cache_t *c, cache_entry_t *e) {
+    cache_entry_t **link = &(c->buckets[e->hash & (c->num_buckets - 1)]);
+    while (*link != e) {
+        link = &((*link)->chain);
+    }
+    *link = e->chain;
+
+    if (e->next == e) {
+        c->hand = NULL;
+    } else {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+        if (c->hand == e) {
+            c->hand = e->next;
+        }
+    }
+
+    c->used -= entry_size(e);
+    e->linked = false;
+
+    if (e->refs == 0) {
+        entry_free(e);
+    }
+}
+
+static cache_entry_t *entry_find(cache_t *c, const char *uri, uint32_t h) {
+    cache_entry_t *e = c->buckets[h & (c->num_buckets - 1)];
+    while (e != NULL && (e->hash != h || strcmp(e->uri, uri) != 0)) {
+        e = e->chain;
+    }
+    return e;
+}
+
+cache_t *cache_new(size_t capacity, size_t max_object) {
+    if (capacity == 0) {
+        return NULL;
+    }
+
+    cache_t *c = (cache_t *) malloc(sizeof(cache_t));
+
+    c->capacity = capacity;
+    c->max_object = max_object < capacity ? max_object : capacity;
+    c->used = 0;
+
+    // roughly one bucket per 4KiB of capacity
+    c->num_buckets = 256;
+    while (c->num_buckets < 65536 && (size_t) c->num_buckets * 4096 < capacity) {
+        c->num_buckets <<= 1;
+    }
+    c->buckets = (cache_entry_t **) calloc(c->num_buckets, sizeof(cache_entry_t *));
+    c->hand = NULL;
+
+    atomic_init(&(c->hits), 0);
+    atomic_init(&(c->misses), 0);
+
+    pthread_mutex_init(&(c->lock), NULL);
+
+    return c;
+}
+
+void cache_delete(cache_t **c) {
+    while ((*c)->hand != NULL) {
+        entry_unlink(*c, (*c)->hand);
+    }
+    pthread_mutex_destroy(&((*c)->lock));
+    free((*c)->buckets);
+    free(*c);
+    *c = NULL;
+}
+
+cache_entry_t *cache_get(cache_t *c, const char *uri) {
+    uint32_t h = cache_hash(uri);
+
+    pthread_mutex_lock(&(c->lock));
+    cache_entry_t *e = entry_find(c, uri, h);
+    if (e != NULL) {
+        e->refs += 1;
+        e->referenced = true;
+    }
+    pthread_mutex_unlock(&(c->lock));
+
+    atomic_fetch_add_explicit(e != NULL ? &(c->hits) : &(c->misses), 1, memory_order_relaxed);
+
+    return e;
+}
+
+void cache_release(cache_t *c, cache_entry_t *e) {
+    pthread_mutex_lock(&(c->lock));
+    e->refs -= 1;
+    bool dead = e->refs == 0 && !e->linked;
+    pthread_mutex_unlock(&(c->lock));
+
+    if (dead) {
+        entry_free(e);
+    }
+}
+
+cache_entry_t *cache_insert(cache_t *c, const char *uri, const char *header, size_t header_len,
+    int fd, size_t size) {
+    if (size > c->max_object || header_len + size > c->capacity) {
+        return NULL;
+    }
+
+    // build the entry outside the lock, the caller keeps writers of uri out
+    cache_entry_t *e = (cache_entry_t *) malloc(sizeof(cache_entry_t));
+    e->data = (char *) malloc(header_len + size);
+    memcpy(e->data, header, header_len);
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = pread(fd, e->data + header_len + total, size - total, total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(e->data);
+            free(e);
+            return NULL;
+        }
+        total += n;
+    }
+
+    e->uri = strdup(uri);
+    e->hash = cache_hash(uri);
+    e->header_len = header_len;
+    e->body_len = size;
+    e->refs = 1;
+    e->referenced = false;
+    e->linked = true;
+
+    pthread_mutex_lock(&(c->lock));
+
+    cache_entry_t *old = entry_find(c, uri, e->hash);
+    if (old != NULL) {
+        entry_unlink(c, old);
+    }
+
+    // CLOCK: skip over recently referenced entries once, evict the first one that is not
+    while (c->used + entry_size(e) > c->capacity && c->hand != NULL) {
+        cache_entry_t *victim = c->hand;
+        if (victim->referenced) {
+            victim->referenced = false;
+            c->hand = victim->next;
+        } else {
+            entry_unlink(c, victim);
+        }
+    }
+
+    cache_entry_t **bucket = &(c->buckets[e->hash & (c->num_buckets - 1)]);
+    e->chain = *bucket;
+    *bucket = e;
+
+    // new entries go just behind the hand so they survive a full sweep
+    if (c->hand == NULL) {
+        e->prev = e;
+        e->next = e;
+        c->hand = e;
+    } else {
+        e->next = c->hand;
+        e->prev = c->hand->prev;
+        c->hand->prev->next = e;
+        c->hand->prev = e;
+    }
+    c->used += entry_size(e);
+
+    pthread_mutex_unlock(&(c->lock));
+
+    return e;
+}
+
+void cache_invalidate(cache_t *c, const char *uri) {
+    uint32_t h = cache_hash(uri);
+
+    pthread_mutex_lock(&(c->lock));
+    cache_entry_t *e = entry_find(c, uri, h);
+    if (e != NULL) {
+        entry_unlink(c, e);
+    }
+    pthread_mutex_unlock(&(c->lock));
+}
+
+ssize_t cache_entry_send(cache_entry_t *e, int out) {
+    return write_n_bytes(out, e->data, entry_size(e));
+}
+
+void cache_stats(cache_t *c, uint64_t *hits, uint64_t *misses) {
+    *hits = atomic_load(&(c->hits));
+    *misses = atomic_load(&(c->misses));
+}
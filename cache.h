@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct cache cache_t;
+typedef struct cache_entry cache_entry_t;
+
+/** @brief Dynamically allocates and initializes a new object cache that
+ *         holds at most capacity bytes of response headers and bodies,
+ *         evicting with the CLOCK algorithm.
+ *
+ *  @param capacity the maximum number of bytes cached.
+ *
+ *  @param max_object the largest body that is cached.
+ *
+ *  @return a pointer to a new cache_t, or NULL if capacity is 0.
+ */
+cache_t *cache_new(size_t capacity, size_t max_object);
+
+/** @brief Delete your cache and free all of its memory.  No entry may
+ *         still be held.
+ *
+ *  @param c the cache to be deleted.
+ */
+void cache_delete(cache_t **c);
+
+/** @brief look up the entry for uri and hold it.  Counts a hit or a miss.
+ *
+ *  @return the held entry, which must be given back with cache_release,
+ *          or NULL on a miss.
+ */
+cache_entry_t *cache_get(cache_t *c, const char *uri);
+
+/** @brief give back an entry held by cache_get or cache_insert.
+ *
+ */
+void cache_release(cache_t *c, cache_entry_t *e);
+
+/** @brief cache the prebuilt header followed by size bytes read from the
+ *         start of fd as the response for uri, replacing any entry for
+ *         uri.  The caller must keep writers of uri out while this runs.
+ *
+ *  @return the held new entry, or NULL if the body is too large or the
+ *          file could not be read.
+ */
+cache_entry_t *cache_insert(cache_t *c, const char *uri, const char *header, size_t header_len,
+    int fd, size_t size);
+
+/** @brief drop the entry for uri, if any.  Holders of the entry keep a
+ *         valid copy until they release it.
+ *
+ */
+void cache_invalidate(cache_t *c, const char *uri);
+
+/** @brief write the header and body of e to out, which are stored back
+ *         to back so this is a single write for most responses.
+ *
+ *  @return The number of bytes written, or, -1, indicating an error.
+ *          Sets errno according to any errors that occur.
+ */
+ssize_t cache_entry_send(cache_entry_t *e, int out);
+
+/** @brief read the hit and miss counters.
+ *
+ */
+void cache_stats(cache_t *c, uint64_t *hits, uint64_t *misses);
@@ -0,0 +1,140 @@
+#include "chunked.h"
+
+// a chunk size is at most 16 hex digits, so it always fits in 64 bits
+#define MAX_DIGITS 16
+
+enum {
+    SIZE,           // hex digits of the chunk size
+    EXT,            // chunk extensions, ignored up to the end of the line
+    SIZE_LF,        // LF ending the size line
+    DATA,           // payload, taken by the caller
+    DATA_CR,        // CRLF after the payload
+    DATA_LF,
+    TRAILER,        // start of a trailer line, or the empty line ending the body
+    TRAILER_LINE,   // a trailer field, ignored
+    TRAILER_LF,     // LF of the empty line
+    DONE,
+};
+
+void chunked_init(chunked_t *c) {
+    c->state = SIZE;
+    c->digits = 0;
+    c->size = 0;
+    c->remaining = 0;
+}
+
+static int hex(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+// the size line is over, the last chunk has size 0 and leads into the trailers
+static void size_done(chunked_t *c) {
+    c->state = c->size == 0 ? TRAILER : DATA;
+    c->remaining = c->size;
+    c->size = 0;
+    c->digits = 0;
+}
+
+ssize_t chunked_parse(chunked_t *c, const char *buf, size_t len) {
+    size_t i = 0;
+
+    while (i < len && c->state != DONE) {
+        char ch = buf[i];
+
+        switch (c->state) {
+            case SIZE: {
+                int d = hex(ch);
+                if (d >= 0) {
+                    if (++c->digits > MAX_DIGITS) {
+                        return -1;
+                    }
+                    c->size = (c->size << 4) | (uint64_t) d;
+                } else if (c->digits == 0) {
+                    return -1;
+                } else if (ch == ';' || ch == ' ' || ch == '\t') {
+                    c->state = EXT;
+                } else if (ch == '\r') {
+                    c->state = SIZE_LF;
+                } else if (ch == '\n') {
+                    size_done(c);
+                } else {
+                    return -1;
+                }
+                break;
+            }
+            case EXT:
+                if (ch == '\n') {
+                    size_done(c);
+                }
+                break;
+            case SIZE_LF:
+                if (ch != '\n') {
+                    return -1;
+                }
+                size_done(c);
+                break;
+            case DATA:
+                // the caller takes the payload
+                return (ssize_t) i;
+            case DATA_CR:
+                if (ch == '\r') {
+                    c->state = DATA_LF;
+                } else if (ch == '\n') {
+                    c->state = SIZE;
+                } else {
+                    return -1;
+                }
+                break;
+            case DATA_LF:
+                if (ch != '\n') {
+                    return -1;
+                }
+                c->state = SIZE;
+                break;
+            case TRAILER:
+                if (ch == '\r') {
+                    c->state = TRAILER_LF;
+                } else if (ch == '\n') {
+                    c->state = DONE;
+                } else {
+                    c->state = TRAILER_LINE;
+                }
+                break;
+            case TRAILER_LINE:
+                if (ch == '\n') {
+                    c->state = TRAILER;
+                }
+                break;
+            case TRAILER_LF:
+                if (ch != '\n') {
+                    return -1;
+                }
+                c->state = DONE;
+                break;
+        }
+
+        i++;
+    }
+
+    return (ssize_t) i;
+}
+
+void chunked_take(chunked_t *c, uint64_t n) {
+    c->remaining -= n;
+    if (c->remaining == 0) {
+        c->state = DATA_CR;
+    }
+}
+
+bool chunked_done(chunked_t *c) {
+    return c->state == DONE;
+}
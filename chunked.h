@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct {
+    int state;
+    int digits;
+    uint64_t size;
+
+    // payload bytes of the current chunk the caller has not taken yet
+    uint64_t remaining;
+} chunked_t;
+
+/** @brief Initializes a decoder for a body in the chunked transfer coding.
+ *
+ *  @param c The decoder.
+ */
+void chunked_init(chunked_t *c);
+
+/** @brief Scans the framing (chunk sizes, extensions, line ends and
+ *         trailers) at the start of buf.  Stops at the first payload
+ *         byte, at the end of the body, or at the end of buf, so it never
+ *         consumes anything past the body.  Payload bytes are not consumed
+ *         here: once c->remaining is non-zero, the caller moves up to that
+ *         many bytes wherever it wants and reports them with chunked_take.
+ *
+ *  @param c The decoder.
+ *
+ *  @param buf The next bytes of the body.
+ *
+ *  @param len The number of bytes in buf.
+ *
+ *  @return The number of bytes of buf consumed, or, -1, if the framing is
+ *          malformed.
+ */
+ssize_t chunked_parse(chunked_t *c, const char *buf, size_t len);
+
+/** @brief Accounts for n payload bytes the caller took, at most
+ *         c->remaining.
+ *
+ *  @param c The decoder.
+ *
+ *  @param n The number of payload bytes taken.
+ */
+void chunked_take(chunked_t *c, uint64_t n);
+
+/** @brief Checks whether the last chunk and the trailers have been read.
+ *
+ *  @param c The decoder.
+ *
+ *  @return true if the body is complete.
+ */
+bool chunked_done(chunked_t *c);
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+
+#include "connection.h"
+#include "iowrapper.h"
+#include "parser.h"
+#include "protocol.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// a request line and a header line, anchored at the start of what is left of the head
+#define REQUEST_LINE_REGEX "^(" TYPE_REGEX ") (" URI_REGEX ") (" HTTP_REGEX ")\r\n"
+#define HEADER_LINE_REGEX  "^(" HEADER_FIELD_REGEX "): (" HEADER_VALUE_REGEX ")\r\n"
+
+struct field {
+    char *name;
+    char *value;
+};
+
+struct Conn {
+    int fd;
+
+    // the head, and whatever was read past it (the start of a body, or pipelined
+    // requests), one byte spare so the head can be NUL terminated for regexec
+    char buf[MAX_HEADER_LEN + 1];
+    size_t len;
+
+    // the first byte of buf that has not been consumed
+    size_t pos;
+
+    const Request_t *request;
+    char *uri;
+    struct field fields[PARSER_MAX_FIELDS];
+    int num_fields;
+
+    // a handler answered without reading the whole request
+    bool close;
+};
+
+static ssize_t read_fd(int fd, void *buf, size_t len, int timeout_ms);
+
+static regex_t request_line_re;
+static regex_t header_line_re;
+static pthread_once_t regex_once = PTHREAD_ONCE_INIT;
+static bool use_regex = false;
+static conn_read_fn reader = read_fd;
+
+static void regex_init(void) {
+    regcomp(&request_line_re, REQUEST_LINE_REGEX, REG_EXTENDED);
+    regcomp(&header_line_re, HEADER_LINE_REGEX, REG_EXTENDED);
+}
+
+// the reader unless conn_use_reader replaced it, a poll only when there is a timeout
+static ssize_t read_fd(int fd, void *buf, size_t len, int timeout_ms) {
+    if (timeout_ms >= 0) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready <= 0) {
+            errno = ready == 0 ? ETIME : errno;
+            return -1;
+        }
+    }
+
+    return read(fd, buf, len);
+}
+
+// appends whatever the socket has to buf, returns like read(2)
+static ssize_t fill(conn_t *conn, int timeout_ms) {
+    return reader(conn->fd, conn->buf + conn->len, MAX_HEADER_LEN - conn->len, timeout_ms);
+}
+
+// reads until buf holds a whole head, returns its length or 0 if none arrives
+static size_t read_head(conn_t *conn) {
+    size_t searched = 0;
+
+    while (1) {
+        char *end = memmem(conn->buf + searched, conn->len - searched, "\r\n\r\n", 4);
+        if (end != NULL) {
+            return end + 4 - conn->buf;
+        }
+        if (conn->len == MAX_HEADER_LEN) {
+            return 0;
+        }
+        searched = conn->len > 3 ? conn->len - 3 : 0;
+
+        ssize_t got = fill(conn, -1);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 0;
+        }
+        conn->len += got;
+    }
+}
+
+static void set_request(conn_t *conn, const char *method) {
+    conn->request = &REQUEST_UNSUPPORTED;
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        if (requests[i] != &REQUEST_UNSUPPORTED && strcmp(method, request_get_str(requests[i])) == 0) {
+            conn->request = requests[i];
+        }
+    }
+}
+
+// parser_parse tells after every read whether the head is complete, and rejects a
+// malformed one as soon as it goes wrong, the parts are terminated in place
+static const Response_t *parse_fast(conn_t *conn) {
+    parser_request_t req;
+    ssize_t head;
+
+    while ((head = parser_parse(conn->buf, conn->len, &req)) == 0) {
+        ssize_t got = fill(conn, -1);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return &RESPONSE_BAD_REQUEST;
+        }
+        conn->len += got;
+    }
+    if (head < 0) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    char *buf = conn->buf;
+    conn->pos = head;
+
+    buf[req.method + req.method_len] = '\0';
+    set_request(conn, buf + req.method);
+    conn->uri = buf + req.uri;
+    buf[req.uri + req.uri_len] = '\0';
+
+    for (uint16_t i = 0; i < req.num_fields; i++) {
+        struct field *f = &(conn->fields[i]);
+        f->name = buf + req.fields[i].name;
+        f->value = buf + req.fields[i].value;
+        buf[req.fields[i].name + req.fields[i].name_len] = '\0';
+        buf[req.fields[i].value + req.fields[i].value_len] = '\0';
+    }
+    conn->num_fields = req.num_fields;
+
+    return strncmp(buf + req.version, HTTP_VERSION, strlen(HTTP_VERSION)) == 0 ? NULL
+        : &RESPONSE_VERSION_NOT_SUPPORTED;
+}
+
+// the head is NUL terminated while the regular expressions run over it, field
+// names, values and the uri are terminated in place
+static const Response_t *parse_head(conn_t *conn, size_t head) {
+    char *buf = conn->buf;
+    regmatch_t m[4];
+
+    if (regexec(&request_line_re, buf, 4, m, 0) != 0) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    buf[m[1].rm_eo] = '\0';
+    buf[m[2].rm_eo] = '\0';
+    buf[m[3].rm_eo] = '\0';
+
+    set_request(conn, buf);
+    conn->uri = buf + m[2].rm_so + 1;
+    bool version_ok = strcmp(buf + m[3].rm_so, HTTP_VERSION) == 0;
+
+    size_t off = m[0].rm_eo;
+    while (off < head - 2) {
+        if (conn->num_fields == PARSER_MAX_FIELDS || regexec(&header_line_re, buf + off, 3, m, 0) != 0) {
+            return &RESPONSE_BAD_REQUEST;
+        }
+
+        struct field *f = &(conn->fields[conn->num_fields++]);
+        f->name = buf + off + m[1].rm_so;
+        f->value = buf + off + m[2].rm_so;
+        buf[off + m[1].rm_eo] = '\0';
+        buf[off + m[2].rm_eo] = '\0';
+        off += m[0].rm_eo;
+    }
+
+    if (off != head - 2) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    return version_ok ? NULL : &RESPONSE_VERSION_NOT_SUPPORTED;
+}
+
+conn_t *conn_new(int connfd) {
+    conn_t *conn = (conn_t *) malloc(sizeof(conn_t));
+
+    conn->fd = connfd;
+    conn->len = 0;
+    conn->pos = 0;
+    conn->request = NULL;
+    conn->uri = NULL;
+    conn->num_fields = 0;
+    conn->close = false;
+
+    return conn;
+}
+
+void conn_delete(conn_t **conn) {
+    if (*conn == NULL) {
+        return;
+    }
+
+    free(*conn);
+    *conn = NULL;
+}
+
+static const Response_t *parse_regex(conn_t *conn) {
+    pthread_once(&regex_once, regex_init);
+
+    size_t head = read_head(conn);
+    if (head == 0) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    // only the head is parsed, the byte after it belongs to the body or the next request
+    char saved = conn->buf[head];
+    conn->buf[head] = '\0';
+    const Response_t *res = parse_head(conn, head);
+    conn->buf[head] = saved;
+    conn->pos = head;
+
+    return res;
+}
+
+void conn_use_regex(bool on) {
+    use_regex = on;
+}
+
+void conn_use_reader(conn_read_fn fn) {
+    reader = fn;
+}
+
+const Response_t *conn_parse(conn_t *conn) {
+    const Response_t *res = use_regex ? parse_regex(conn) : parse_fast(conn);
+    if (res != NULL) {
+        return res;
+    }
+
+    // a length has to be a number, and a PUT needs some way to tell where its body ends
+    char *length = conn_get_header(conn, "Content-Length");
+    if (length != NULL && (length[0] == '\0' || strspn(length, "0123456789") != strlen(length))) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+    if (conn->request == &REQUEST_PUT && length == NULL && conn_get_header(conn, "Transfer-Encoding") == NULL) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    return NULL;
+}
+
+const Request_t *conn_get_request(conn_t *conn) {
+    return conn->request;
+}
+
+char *conn_get_uri(conn_t *conn) {
+    return conn->uri;
+}
+
+char *conn_get_header(conn_t *conn, char *header) {
+    for (int i = 0; i < conn->num_fields; i++) {
+        if (strcasecmp(conn->fields[i].name, header) == 0) {
+            return conn->fields[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+void conn_set_close(conn_t *conn) {
+    conn->close = true;
+}
+
+bool conn_get_close(conn_t *conn) {
+    return conn->close;
+}
+
+conn_t *conn_next(conn_t **conn) {
+    conn_t *next = conn_new((*conn)->fd);
+
+    next->len = (*conn)->len - (*conn)->pos;
+    memcpy(next->buf, (*conn)->buf + (*conn)->pos, next->len);
+
+    conn_delete(conn);
+
+    return next;
+}
+
+bool conn_buffered(conn_t *conn) {
+    return conn->pos < conn->len;
+}
+
+bool conn_wait(conn_t *conn, int timeout_ms) {
+    // a full buffer is a head too long to parse, conn_parse rejects it without reading
+    if (conn->len == MAX_HEADER_LEN) {
+        return true;
+    }
+
+    while (1) {
+        ssize_t got = fill(conn, timeout_ms);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        conn->len += got;
+        return true;
+    }
+}
+
+const Response_t *conn_recv_file(conn_t *conn, int fd) {
+    char *length_str = conn_get_header(conn, "Content-Length");
+    if (length_str == NULL) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+    size_t length = (size_t) strtoull(length_str, NULL, 10);
+
+    // whatever of the body came in with the head, then the rest from the socket
+    ssize_t buffered = conn_recv_buffered(conn, fd, length);
+    if (buffered < 0) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    ssize_t moved = pass_n_bytes(conn->fd, fd, length - buffered);
+    if (moved < 0) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+    if ((size_t) moved != length - buffered) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    return NULL;
+}
+
+ssize_t conn_recv_buffered(conn_t *conn, int fd, size_t n) {
+    size_t buffered = conn->len - conn->pos < n ? conn->len - conn->pos : n;
+
+    if (write_n_bytes(fd, conn->buf + conn->pos, buffered) != (ssize_t) buffered) {
+        return -1;
+    }
+    conn->pos += buffered;
+
+    return buffered;
+}
+
+ssize_t conn_peek_buffered(conn_t *conn, char *buf, size_t n) {
+    size_t buffered = conn->len - conn->pos < n ? conn->len - conn->pos : n;
+    memcpy(buf, conn->buf + conn->pos, buffered);
+
+    return buffered;
+}
+
+size_t conn_skip_buffered(conn_t *conn, size_t n) {
+    size_t buffered = conn->len - conn->pos < n ? conn->len - conn->pos : n;
+    conn->pos += buffered;
+
+    return buffered;
+}
+
+// sends all n bytes of buf, with MSG_MORE the kernel holds them until the next write
+static bool send_all(int fd, const char *buf, size_t n, bool more) {
+    for (size_t off = 0; off < n; ) {
+        ssize_t sent = send(fd, buf + off, n - off, (more ? MSG_MORE : 0) | MSG_NOSIGNAL);
+        if (sent < 0 && errno != EINTR) {
+            return false;
+        }
+        off += sent > 0 ? (size_t) sent : 0;
+    }
+    return true;
+}
+
+const Response_t *conn_send_file(conn_t *conn, int fd, uint64_t count) {
+    char head[128];
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 %hu %s\r\nContent-Length: %lu\r\n\r\n",
+        response_get_code(&RESPONSE_OK), response_get_message(&RESPONSE_OK), (unsigned long) count);
+
+    // written on its own, the header goes out as a small segment and Nagle holds the body
+    // back until the client's delayed ACK of it, which stalls a keep-alive connection
+    if (!send_all(conn->fd, head, len, count > 0) || pass_n_bytes(fd, conn->fd, count) != (ssize_t) count) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    return NULL;
+}
+
+const Response_t *conn_send_response(conn_t *conn, const Response_t *res) {
+    // the body is the message itself
+    const char *message = response_get_message(res);
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "HTTP/1.1 %hu %s\r\nContent-Length: %zu\r\n\r\n%s\n",
+        response_get_code(res), message, strlen(message) + 1, message);
+
+    if (write_n_bytes(conn->fd, buf, len) != len) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    return NULL;
+}
+
+char *conn_str(conn_t *conn) {
+    static __thread char str[MAX_URI_LEN + 64];
+
+    snprintf(str, sizeof(str), "fd %d: %s /%s, %d fields, %zu bytes buffered", conn->fd,
+        conn->request == NULL ? "(none)" : request_get_str(conn->request), conn->uri == NULL ? "" : conn->uri,
+        conn->num_fields, conn->len - conn->pos);
+
+    return str;
+}
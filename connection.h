@@ -18,9 +18,24 @@ void conn_delete(conn_t **conn);
 // Parse the data from connection. Checks static correctness (i.e.,
 // that each field fits within our required bounds), but does not
 // check for semantic correctness (e.g., does not check that a URI is
-// not a directory).
+// not a directory).  The bounds are those of protocol.h, which
+// parser_parse (parser.h) checks in a single pass over the head.
 const Response_t *conn_parse(conn_t *conn);
 
+// Parse with the regular expressions in protocol.h instead of with
+// parser_parse.  Both accept the same requests, the regular expressions
+// are kept to compare against.  Call before the first conn_parse.
+void conn_use_regex(bool on);
+
+// Reads at most len bytes of the socket fd into buf, waiting at most
+// timeout_ms milliseconds for them, or for ever if timeout_ms is -1.
+// Returns like read(2), with errno set to ETIME if the time ran out.
+typedef ssize_t (*conn_read_fn)(int fd, void *buf, size_t len, int timeout_ms);
+
+// Read from the socket with fn instead of with poll(2) and read(2),
+// e.g. with uring_recv (uring.h).  Call before the first conn_parse.
+void conn_use_reader(conn_read_fn fn);
+
 //////////////////////////////////////////////////////////////////////
 // Functions that get stuff we might need elsewhere from a connection
 
@@ -30,16 +45,59 @@ const Request_t *conn_get_request(conn_t *conn);
 // Return URI from parsing.
 char *conn_get_uri(conn_t *conn);
 
-// Return the value for the header field named header.  Only
-// implemented for header named "Content-Length" and "Request-Id".
+// Return the value for the header field named header, compared
+// without regard to case, or NULL if the request has no such field.
+// The first one wins if a field appears more than once.  A request
+// with "Transfer-Encoding" in place of "Content-Length" passes
+// conn_parse, its body is left to the caller.
 char *conn_get_header(conn_t *conn, char *header);
 
+//////////////////////////////////////////////////////////////////////
+// Functions for persistent (keep-alive) connections
+
+// Constructor for the next request on the same socket.  Takes over any
+// bytes conn already read past the end of its request (i.e., pipelined
+// requests), then deletes conn and sets it to NULL.
+conn_t *conn_next(conn_t **conn);
+
+// Return true if conn holds bytes that have been read from the socket
+// but not parsed yet, i.e., conn_parse will not block on the socket.
+bool conn_buffered(conn_t *conn);
+
+// Wait up to timeout_ms milliseconds for the client to send more and
+// read what arrives into conn.  Returns true if anything did, false if
+// the time ran out, the client closed the socket or the read failed.
+bool conn_wait(conn_t *conn, int timeout_ms);
+
+// Mark conn as the last request on its socket, e.g., because it was
+// answered without reading all of its body, whose remaining bytes
+// would otherwise be parsed as the next request.
+void conn_set_close(conn_t *conn);
+
+// Return true if conn_set_close was called on conn.
+bool conn_get_close(conn_t *conn);
+
 //////////////////////////////////////////////////////////////////////
 // Functions that help get data from a connection
 
 // write the data form the connection into the file (fd).
 const Response_t *conn_recv_file(conn_t *conn, int fd);
 
+// write the part of the message body that conn already read along with
+// the header, at most n bytes, into the file (fd).  Returns the number
+// of bytes written, or -1 on error.  The rest of the body is still
+// unread on the socket.
+ssize_t conn_recv_buffered(conn_t *conn, int fd, size_t n);
+
+// copy the part of the message body that conn already read along with
+// the header, at most n bytes, into buf without consuming it.  Returns
+// the number of bytes copied, 0 once conn holds no more of them.
+ssize_t conn_peek_buffered(conn_t *conn, char *buf, size_t n);
+
+// drop at most n of the bytes conn_peek_buffered would return.  Returns
+// the number of bytes dropped.
+size_t conn_skip_buffered(conn_t *conn, size_t n);
+
 //////////////////////////////////////////////////////////////////////
 // Functions that help write responses to the client:
 
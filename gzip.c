@@ -0,0 +1,178 @@
+#include "gzip.h"
+#include "iowrapper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// bytes read from the file and written to the sidecar per deflate call
+#define GZIP_CHUNK (64 * 1024)
+
+// zlib's default trade-off, most of the ratio of 9 at a fraction of the CPU
+#define GZIP_LEVEL 6
+
+// 15 bits of window, plus 16 asks deflate for a gzip header and trailer
+#define GZIP_WINDOW (15 + 16)
+
+static atomic_ulong tmp_counter;
+
+static atomic_ulong stat_files;
+static atomic_ulong stat_in;
+static atomic_ulong stat_out;
+static atomic_ulong stat_cpu_ns;
+
+static uint64_t cpu_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+bool gzip_accepted(const char *accept_encoding) {
+    if (accept_encoding == NULL) {
+        return false;
+    }
+
+    const char *p = accept_encoding;
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+
+        const char *name = p;
+        while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t len = (size_t) (p - name);
+
+        // a q of 0 (0, 0.0, 0.000) means not acceptable
+        bool refused = false;
+        const char *params = p;
+        while (*p != '\0' && *p != ',') {
+            p++;
+        }
+        const char *q = strstr(params, "q=");
+        if (q != NULL && q < p) {
+            q += 2;
+            refused = *q == '0';
+            for (q++; refused && q < p && *q != ' ' && *q != '\t'; q++) {
+                refused = *q == '.' || *q == '0';
+            }
+        }
+
+        bool gzip = (len == 4 && strncasecmp(name, "gzip", 4) == 0)
+            || (len == 6 && strncasecmp(name, "x-gzip", 6) == 0) || (len == 1 && *name == '*');
+        if (gzip && !refused) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void gzip_path(char *buf, size_t size, const char *uri) {
+    snprintf(buf, size, ".gz_%s", uri);
+}
+
+static bool gzip_file(int src, int dst, uint64_t *in, uint64_t *out) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, GZIP_LEVEL, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    static __thread unsigned char ibuf[GZIP_CHUNK];
+    static __thread unsigned char obuf[GZIP_CHUNK];
+    off_t offset = 0;
+    bool ok = true;
+    int flush = Z_NO_FLUSH;
+
+    while (ok && flush != Z_FINISH) {
+        ssize_t n = pread(src, ibuf, sizeof(ibuf), offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        offset += n;
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+
+        z.next_in = ibuf;
+        z.avail_in = (unsigned) n;
+        do {
+            z.next_out = obuf;
+            z.avail_out = sizeof(obuf);
+            deflate(&z, flush);
+            size_t have = sizeof(obuf) - z.avail_out;
+            if (have > 0 && write_n_bytes(dst, (char *) obuf, have) != (ssize_t) have) {
+                ok = false;
+            }
+        } while (ok && z.avail_out == 0);
+    }
+
+    *in = z.total_in;
+    *out = z.total_out;
+    deflateEnd(&z);
+
+    return ok;
+}
+
+int gzip_open(const char *uri, int src, const struct stat *src_st, struct stat *st) {
+    char path[96];
+    gzip_path(path, sizeof(path), uri);
+
+    // a sidecar is current if it carries the file's mtime, a PUT removes it anyway
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (fstat(fd, st) == 0 && st->st_mtim.tv_sec == src_st->st_mtim.tv_sec
+            && st->st_mtim.tv_nsec == src_st->st_mtim.tv_nsec) {
+            return fd;
+        }
+        close(fd);
+    }
+
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), ".gztmp_%lu", atomic_fetch_add(&tmp_counter, 1));
+    int out = open(tmp, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (out < 0) {
+        return -1;
+    }
+
+    uint64_t start = cpu_now();
+    uint64_t in_bytes = 0, out_bytes = 0;
+    struct timespec times[2] = { src_st->st_atim, src_st->st_mtim };
+
+    if (!gzip_file(src, out, &in_bytes, &out_bytes) || futimens(out, times) < 0 || rename(tmp, path) < 0
+        || fstat(out, st) < 0) {
+        unlink(tmp);
+        close(out);
+        return -1;
+    }
+
+    atomic_fetch_add_explicit(&stat_files, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat_in, in_bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat_out, out_bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat_cpu_ns, cpu_now() - start, memory_order_relaxed);
+
+    return out;
+}
+
+void gzip_invalidate(const char *uri) {
+    char path[96];
+    gzip_path(path, sizeof(path), uri);
+    unlink(path);
+}
+
+void gzip_stats(uint64_t *files, uint64_t *in, uint64_t *out, uint64_t *cpu_ns) {
+    *files = atomic_load_explicit(&stat_files, memory_order_relaxed);
+    *in = atomic_load_explicit(&stat_in, memory_order_relaxed);
+    *out = atomic_load_explicit(&stat_out, memory_order_relaxed);
+    *cpu_ns = atomic_load_explicit(&stat_cpu_ns, memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// smaller files go out as they are, the gzip header and Vary would eat most of the gain
+#define GZIP_MIN_SIZE 256
+
+/** @brief Checks whether an Accept-Encoding value lets us answer with
+ *         gzip, i.e., it names gzip, x-gzip or * without q=0.
+ *
+ *  @param accept_encoding The header value, or NULL.
+ *
+ *  @return true if a gzip body is acceptable.
+ */
+bool gzip_accepted(const char *accept_encoding);
+
+/** @brief Writes the path of uri's gzip sidecar, ".gz_" followed by the
+ *         uri.  '_' cannot appear in a uri, so sidecars never collide
+ *         with, or are served as, targets.
+ *
+ *  @param buf The buffer to write to.
+ *
+ *  @param size The capacity of buf.
+ *
+ *  @param uri The uri of the file.
+ */
+void gzip_path(char *buf, size_t size, const char *uri);
+
+/** @brief Opens uri's gzip sidecar, compressing the file first if the
+ *         sidecar is missing or does not carry the file's mtime.  A new
+ *         sidecar is written to a temp file and renamed into place, so
+ *         threads racing to create it are harmless.  The caller holds
+ *         uri's lock, so the file cannot change meanwhile.
+ *
+ *  @param uri The uri of the file.
+ *
+ *  @param src The open file.
+ *
+ *  @param src_st The file's attributes.
+ *
+ *  @param st Filled in with the sidecar's attributes.
+ *
+ *  @return The sidecar's file descriptor, or, -1, indicating an error.
+ */
+int gzip_open(const char *uri, int src, const struct stat *src_st, struct stat *st);
+
+/** @brief Removes uri's gzip sidecar.  The caller holds uri's writer lock.
+ *
+ *  @param uri The uri of the file.
+ */
+void gzip_invalidate(const char *uri);
+
+/** @brief Reads the totals over every sidecar created so far.
+ *
+ *  @param files Set to the number of sidecars created.
+ *
+ *  @param in Set to the bytes compressed.
+ *
+ *  @param out Set to the bytes those compressed to.
+ *
+ *  @param cpu_ns Set to the thread CPU time spent compressing.
+ */
+void gzip_stats(uint64_t *files, uint64_t *in, uint64_t *out, uint64_t *cpu_ns);
@@ -6,6 +6,18 @@
 #include "protocol.h"
 #include "queue.h"
 #include "rwlock.h"
+#include "slots.h"
+#include "reactor.h"
+#include "zerocopy.h"
+#include "cache.h"
+#include "scheduler.h"
+#include "auditlog.h"
+#include "uring.h"
+#include "metrics.h"
+#include "range.h"
+#include "validator.h"
+#include "chunked.h"
+#include "gzip.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -13,7 +25,12 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,56 +40,153 @@
 //                                                   STRUCTS
 //-----------------------------------------------------------------------------------------------------------------
 
-struct slot {
-    char* uri;
-    rwlock_t* lock;
-    int num_workers;
-};
-
 struct thread_arguments {
     int tid;
     int num_threads;
 };
 
-typedef struct slot slot_t;
+// a connection waiting in queue_global, carried by value, served counts the requests
+// it got before the reactor took it back, so -k holds across handoffs
+struct job {
+    int connfd;
+    int served;
+    uint64_t enqueued_ns;
+};
+
 typedef struct thread_arguments thread_arguments_t;
+typedef struct job job_t;
+
+#define USAGE "usage: %s [-t threads] [-m min_threads] [-r retire_ms] [-a acceptors] [-P] [-q queue_depth] [-k max_requests] [-i idle_ms] [-s] [-e] [-Z] [-U] [-R] [-c cache_mb] [-l log_file] [-p] [-g] <port>\n"
+
+// longest an audit log entry waits in its thread's buffer before it is written
+#define AUDIT_FLUSH_MS 5
+
+// how long an acceptor sleeps when accept fails for lack of fds or memory
+#define ACCEPT_BACKOFF_MS 10
+
+// number of uris listed by the lock profile dump
+#define PROFILE_TOP 20
+
+// reserved uri of the metrics page, '_' would not get past the request parser
+#define METRICS_URI ".metrics"
+
+// bytes of a chunked body peeked at once, enough for the framing and small chunks
+#define CHUNK_PEEK 4096
 
 //-----------------------------------------------------------------------------------------------------------------
 //                                              GLOBAL VARIABLES
 //-----------------------------------------------------------------------------------------------------------------
 
 queue_t* queue_global;
-pthread_mutex_t mutex_global;
-slot_t** worker_slots;
-char** hash_global;
+int queue_depth = 1024;
+int acceptors = 1;
+
+// with -P every acceptor listens on its own SO_REUSEPORT socket instead of sharing one
+bool reuseport_mode = false;
+
+bool steal_mode = false;
+scheduler_t* scheduler_global = NULL;
+
+// the pool runs between pool_min and pool_max workers, idle workers above the
+// minimum retire after pool_retire_ms, the pool is fixed when the two are equal
+int pool_min = 0;
+int pool_max;
+int pool_retire_ms = 2000;
+atomic_int pool_size;
+atomic_int pool_idle;
+atomic_int pool_next_tid;
+atomic_ulong pool_spawned;
+atomic_ulong pool_retired;
+
+metrics_t* metrics_global = NULL;
+
+bool lock_profile = false;
+
+// debug builds print the slot table, queue waits, pool and cache stats on SIGUSR1
+#ifdef DEBUG
+bool debug_stats = true;
+#else
+bool debug_stats = false;
+#endif
+
+slots_t* slots_global;
+
+atomic_ulong requests_served;
+atomic_ulong put_tmp_counter;
+
+int keepalive_max = 100;
+int keepalive_idle = 5000;
+
+bool reactor_mode = false;
+reactor_t* reactor_global = NULL;
+
+bool zero_copy = true;
+bool uring_mode = false;
+bool gzip_mode = false;
+
+size_t cache_mb = 0;
+cache_t* cache_global = NULL;
+
+char* log_path = NULL;
+auditlog_t* audit_global = NULL;
+
+// SIGTERM and SIGINT shut the listeners down, the acceptors then return and main
+// writes out the audit log before the process exits
+Listener_Socket_t** listeners_global = NULL;
+int num_listeners = 0;
+atomic_bool stopping;
 
 //-----------------------------------------------------------------------------------------------------------------
 //                                        HELPER FUNCTIONS DECLARATIONS
 //-----------------------------------------------------------------------------------------------------------------
 
-void handle_connection(conn_t*, rwlock_t*, const Response_t*, bool* );
-
-void handle_get(conn_t*, rwlock_t* );
-void handle_put(conn_t*, rwlock_t*, bool* );
+void handle_request(conn_t*, int, const Response_t* );
+void handle_connection(conn_t*, int, rwlock_t*, const Response_t* );
+bool keep_alive(conn_t*, const Response_t*, int );
+bool wait_next_request(conn_t* );
+
+bool handle_get_cached(conn_t*, int );
+char* cache_key(char*, size_t, char*, bool );
+int open_file(char*, struct stat* );
+void handle_get(conn_t*, int, int, struct stat* );
+void handle_put(conn_t*, int, rwlock_t* );
+int put_tmp_open(char*, size_t );
+const Response_t* put_commit(char*, char*, int, bool* );
 void handle_unsupported(conn_t* );
+void handle_reserved(conn_t* );
 void handle_bad_request(conn_t*/*, const Response_t**/ );
 
-bool check_validity (conn_t*, bool* );
-
 char* get_threads(int, char** );
 int check_args(int, char**, char*, int );
 size_t get_port(char**, int );
 
 void audit_log(conn_t*, uint16_t, char* );
 
+int format_ok_header(char*, size_t, uint64_t, struct stat*, char* );
+const Response_t* send_file(conn_t*, int, int, uint64_t, struct stat*, char* );
+const Response_t* send_not_modified(int, struct stat*, char* );
+bool send_head(int, char*, size_t, bool );
+bool send_part(int, int, char*, size_t, uint64_t, uint64_t );
+const Response_t* send_ranges(int, int, struct stat*, range_t*, int );
+const Response_t* recv_file(conn_t*, int, int );
+const Response_t* recv_chunked(conn_t*, int, int );
+
 void* worker_exec(void* );
+void* acceptor_exec(void* );
+
+bool pool_spawn(void );
+bool pool_pop(int, job_t* );
+bool pool_retire(void );
 
-slot_t** worker_slot_init (int );
+uint64_t now_ns(void );
+bool dispatch(int, int, bool );
+bool dispatch_ready(int, int );
+void handle_metrics(conn_t*, int );
 
-slot_t* slot_create(char* );
-void slot_leave(int );
+void print_worker_slots(slots_t* );
 
-void print_worker_slots(slot_t**, int );
+void* signal_exec(void* );
+void profile_dump(void );
 
 //-----------------------------------------------------------------------------------------------------------------
 //                                                    MAIN
@@ -86,50 +200,121 @@ int main (int argc, char** argv) {
     int port = (int) get_port(argv, optind);
     int threads = check_args(argc, argv, threads_str, 4);
 
-    // initialize listener socket
-    Listener_Socket_t *sock = ls_new(port);
-    if (!sock) {
-      fprintf(stderr, "cannot open socket");
-      exit(1);
+    // a client that hangs up mid-response is an error on that connection, not a reason to exit
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGTERM, SIGINT and SIGUSR1 are only ever taken by the signal thread, so block them
+    // before any thread exists and every thread inherits the mask
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    if (lock_profile || debug_stats) {
+        sigaddset(&set, SIGUSR1);
+    }
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    // per-stage latency histograms and status counters, every thread records into its own
+    metrics_global = metrics_new();
+
+    // the audit log goes to stderr unless a file was given
+    int log_fd = STDERR_FILENO;
+    if (log_path != NULL) {
+        log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (log_fd < 0) {
+            fprintf(stderr, "cannot open log file");
+            exit(1);
+        }
+    }
+    audit_global = auditlog_new(log_fd, AUDIT_FLUSH_MS);
+    if (!audit_global) {
+        fprintf(stderr, "cannot start audit log");
+        exit(1);
     }
 
-    // initialize global concurrent queue
-    queue_global = queue_new(threads);
+    // initialize listener sockets, one shared by every acceptor or one each with -P
+    num_listeners = reuseport_mode ? acceptors : 1;
+    listeners_global = (Listener_Socket_t** ) malloc(sizeof(Listener_Socket_t* ) * num_listeners);
+    for (int i = 0; i < num_listeners; i++) {
+        listeners_global[i] = reuseport_mode ? ls_new_reuseport(port) : ls_new(port);
+        if (!listeners_global[i]) {
+          fprintf(stderr, "cannot open socket");
+          exit(1);
+        }
+    }
 
-    //initialize mutex
-    pthread_mutex_init(&mutex_global, NULL);
+    // initialize global concurrent queue, sized independently of the pool to absorb bursts,
+    // or split the same depth into per-worker queues for the work-stealing scheduler
+    if (steal_mode) {
+        int local_depth = queue_depth / threads > 0 ? queue_depth / threads : 1;
+        scheduler_global = scheduler_new(threads, local_depth, sizeof(job_t));
+    }
+    else {
+        queue_global = queue_new(queue_depth, sizeof(job_t));
+    }
 
-    // initialize slots for worker threads
-    worker_slots = worker_slot_init(threads);
+    // the io_uring engine is optional, without kernel support we stay on blocking syscalls
+    if (uring_mode && !uring_supported()) {
+        fprintf(stderr, "io_uring unavailable, using blocking I/O\n");
+        uring_mode = false;
+    }
+    if (uring_mode) {
+        conn_use_reader(uring_recv);
+    }
 
-    // initialize hashtable
-    hash_global = (char** )calloc(threads*2, sizeof(char* ));
+    // in reactor mode idle and slow connections wait in epoll instead of in a worker
+    if (reactor_mode) {
+        reactor_global = reactor_new(dispatch_ready, keepalive_idle);
+        if (!reactor_global) {
+            fprintf(stderr, "cannot start reactor");
+            exit(1);
+        }
+    }
 
-    // create threads
-    pthread_t thread_arr[threads];
-    thread_arguments_t** args_arr = malloc(sizeof(thread_arguments_t* ) * threads);
+    // initialize the hot-file cache if one was asked for
+    if (cache_mb > 0) {
+        size_t capacity = cache_mb << 20;
+        cache_global = cache_new(capacity, capacity / 16);
+    }
 
-    for (int i = 0; i < threads; i++) {
-        thread_arguments_t* args = (thread_arguments_t* )malloc(sizeof(thread_arguments_t));
-        args->tid = i;
-        args->num_threads = threads;
-        args_arr[i] = args;
+    // initialize sharded uri table for worker threads, sized for the largest pool
+    slots_global = slots_new(threads, lock_profile);
 
-        pthread_create(&thread_arr[i], NULL, worker_exec, args_arr[i]);
+    // lock profiling dumps the most contended uris on SIGUSR1, after the debug stats
+    if (lock_profile) {
+        rwlock_profile(true);
+    }
+    pthread_t signal_thread;
+    pthread_create(&signal_thread, NULL, signal_exec, NULL);
+
+    // create the minimum pool, dispatch grows it toward -t under load
+    pool_max = threads;
+    for (int i = 0; i < pool_min; i++) {
+        if (!pool_spawn()) {
+            fprintf(stderr, "cannot create worker threads");
+            exit(1);
+        }
     }
 
-    // listen
-    while (1) {
-        // accept new connection
-        int connfd = ls_accept(sock);
+    // extra acceptors share the listener with this thread, the kernel hands each
+    // pending connection to exactly one of the threads blocked in accept, with -P
+    // each has its own and the kernel picks the listener when the connection arrives
+    pthread_t acceptor_arr[acceptors];
+    for (int i = 1; i < acceptors; i++) {
+        pthread_create(&acceptor_arr[i], NULL, acceptor_exec, listeners_global[reuseport_mode ? i : 0]);
+    }
 
-        // push conn to the queue
-        queue_push(queue_global, &connfd);
+    // listen until SIGTERM or SIGINT
+    acceptor_exec(listeners_global[0]);
 
+    // every answered request is in the audit log before we exit, workers still
+    // answering write their own entries from here on
+    auditlog_stop(audit_global);
+    for (int i = 0; i < num_listeners; i++) {
+        ls_delete(&listeners_global[i]);
     }
-    ls_delete(&sock);
 
-    return 1;
+    return 0;
 }
 
 
@@ -141,152 +326,346 @@ void* worker_exec(void* args) {
 
     thread_arguments_t* props = (thread_arguments_t* ) args;
 
+    // keep each worker and its local queue on one core
+    if (scheduler_global != NULL) {
+        scheduler_pin(props->tid);
+    }
+
     while (1) {
-        // get connfd sent as void*
-        void* c;
-        queue_pop(queue_global, &c);
-        int connfd = *(int *) c;
+        // get the next connection and note how long it waited for a worker,
+        // or leave the pool if none came for a while and the pool can shrink
+        job_t job;
+        if (!pool_pop(props->tid, &job)) {
+            break;
+        }
+        int connfd = job.connfd;
+        metrics_record(metrics_global, STAGE_QUEUE, now_ns() - job.enqueued_ns);
 
-        // create new conneciton and parse it
+        // create new conneciton and serve requests on it until the client closes it,
+        // it goes idle, or it hits the per-connection cap
         conn_t* conn = conn_new(connfd);
-        const Response_t *res = conn_parse(conn);
+        int served = job.served;
+        bool handed_off = false;
 
-        // only enter if statement if request is valid format
-        if (res == NULL) {
+        while (1) {
+            uint64_t start = now_ns();
+            const Response_t *res = conn_parse(conn);
+            metrics_record(metrics_global, STAGE_PARSE, now_ns() - start);
 
-            // get important request attributes
-            char* uri = conn_get_uri(conn);
+            handle_request(conn, connfd, res);
+            metrics_record(metrics_global, STAGE_TOTAL, now_ns() - start);
+            served += 1;
 
-            bool existed = false; 
-            bool valid = check_validity(conn, &existed);
+            if (!keep_alive(conn, res, served)) {
+                break;
+            }
 
-            // initialize state variables and lock to be used
-            int current_slot = -1;
-            bool active_uri = false;
-            rwlock_t* current_lock = rwlock_new(N_WAY, 1);
+            // pipelined bytes carry over into the next request
+            conn = conn_next(&conn);
 
-            if (valid) {
-                // loop through worker_slots array
-                for (int i = 0; i < props->num_threads; i++) {
+            // in reactor mode the reactor waits for the next request instead of this worker
+            if (reactor_global != NULL && !conn_buffered(conn)) {
+                handed_off = true;
+                break;
+            }
 
-                    // if uri is in an active slot we must wait
-                    if (strcmp(worker_slots[i]->uri, uri) == 0 && strcmp(worker_slots[i]->uri, "\0") != 0) {
+            if (!wait_next_request(conn)) {
+                break;
+            }
+        }
 
-                        // acquire mutex
-                        pthread_mutex_lock(&mutex_global);
-                        //set state variables and current lock for operations
-                        current_slot = i;
-                        current_lock = worker_slots[current_slot]->lock;
-                        worker_slots[current_slot]->num_workers += 1;
-                        active_uri = true;
-                        // release mutex
-                        pthread_mutex_unlock(&mutex_global);
+        conn_delete(&conn);
 
-                        break;
-                    }
-                }
+        // close connection socket unless the reactor took it back
+        if (!handed_off || !reactor_add(reactor_global, connfd, served)) {
+            close(connfd);
+        }
+    }
 
-                // if the uri is not currently being accessed we can use a new slot
-                if (active_uri == false) {
-                    // acquire mutex
-
-                    // iterate worker_slots
-                    for (int i = 0; i < props->num_threads; i++) {
-
-                        // check if the slot is open will have empty uri
-                        if (strcmp(worker_slots[i]->uri, "\0") == 0) { 
-
-                            // acquire mutex
-                            pthread_mutex_lock(&mutex_global);
-                            // create a new slot in the worker_slots array
-                            worker_slots[i] = slot_create(uri);
-                            worker_slots[i]->num_workers = 1;
-
-                            // set current lock and current slot, break out of loop once finished
-                            current_slot = i;
-                            current_lock = worker_slots[i]->lock;
-                            // release mutex
-                            pthread_mutex_unlock(&mutex_global);
-                            break;
-                        }
-                    }
-                }
+    free(props);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool pool_spawn(void) {
+
+    // reserve a place in the pool first so racing dispatchers cannot overshoot the maximum
+    int size = atomic_load(&pool_size);
+    do {
+        if (size >= pool_max) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&pool_size, &size, size + 1));
+
+    thread_arguments_t* args = (thread_arguments_t* )malloc(sizeof(thread_arguments_t));
+    args->tid = atomic_fetch_add(&pool_next_tid, 1);
+    args->num_threads = pool_max;
+
+    // workers are detached, a retiring worker cleans up after itself
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, worker_exec, args);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0) {
+        free(args);
+        atomic_fetch_sub(&pool_size, 1);
+        return false;
+    }
+
+    atomic_fetch_add_explicit(&pool_spawned, 1, memory_order_relaxed);
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool pool_pop(int tid, job_t* job) {
+
+    // idle workers are what dispatch looks at to decide whether to grow the pool
+    atomic_fetch_add(&pool_idle, 1);
+
+    bool got = true;
+    if (scheduler_global != NULL) {
+        scheduler_pop(scheduler_global, tid, job);
+    }
+    else if (pool_min == pool_max) {
+        queue_pop(queue_global, job);
+    }
+    else {
+        // wake up every so often to see if this worker is still needed
+        while (!queue_pop_timed(queue_global, job, pool_retire_ms)) {
+            if (pool_retire()) {
+                got = false;
+                break;
             }
-            // handle connection based on if method is GET, PUT, or unsupported using the current lock
-            // acquire the mutex
-            handle_connection(conn, current_lock, res, &existed);
-            if (valid) {
-                slot_leave(current_slot);
+        }
+    }
+
+    atomic_fetch_sub(&pool_idle, 1);
+    return got;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool pool_retire(void) {
+
+    // only idle workers above the minimum may leave
+    int size = atomic_load(&pool_size);
+    do {
+        if (size <= pool_min) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&pool_size, &size, size - 1));
+
+    atomic_fetch_add_explicit(&pool_retired, 1, memory_order_relaxed);
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void* acceptor_exec(void* args) {
+
+    Listener_Socket_t* sock = (Listener_Socket_t* ) args;
+
+    while (1) {
+        // accept new connection
+        int connfd = ls_accept(sock);
+
+        if (connfd < 0) {
+            if (atomic_load(&stopping)) {
+                break;
             }
+
+            // out of fds or memory, the pending connection stays in the backlog and
+            // accept would fail again at once, give workers time to close some
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                usleep(ACCEPT_BACKOFF_MS * 1000);
+            }
+            continue;
         }
-        else {
-            // handle bad request
-            handle_bad_request(conn/*, res*/);
+
+        // hand conn to the reactor, or push it to the queue if there is none, a full
+        // queue shows up here as the time it takes
+        uint64_t start = now_ns();
+        if (!reactor_add(reactor_global, connfd, 0)) {
+            dispatch(connfd, 0, true);
         }
-        // close connection socket
-        close(connfd);
+        metrics_record(metrics_global, STAGE_ACCEPT, now_ns() - start);
     }
 
     return args;
 }
 
 //-----------------------------------------------------------------------------------------------------------------
-slot_t** worker_slot_init (int num_threads){
+uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool dispatch(int connfd, int served, bool wait) {
 
-    // allocate memory for the array of slots
-    slot_t** worker_slots = (slot_t** )calloc(num_threads, sizeof(slot_t* ));
+    // stamp the connection so the worker can tell how long it sat in the queue
+    job_t job = { .connfd = connfd, .served = served, .enqueued_ns = now_ns() };
+    bool pushed = true;
+    if (scheduler_global != NULL) {
+        pushed = wait ? scheduler_push(scheduler_global, &job) : scheduler_try_push(scheduler_global, &job);
+    }
+    else {
+        if (wait) {
+            queue_push(queue_global, &job);
+        }
+        else {
+            pushed = queue_try_push(queue_global, &job);
+        }
 
-    // iterate through each worker slot
-    for (int i = 0; i < num_threads; i++) {
-        // create new slots
-        slot_t* new_slot = slot_create("\0");
-        worker_slots[i] = new_slot;
+        // nobody is waiting for work, so this connection queues behind busy workers
+        if (pool_min < pool_max && atomic_load(&pool_idle) == 0) {
+            pool_spawn();
+        }
     }
 
-    return worker_slots;
+    return pushed;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool dispatch_ready(int connfd, int served) {
+
+    // the reactor's event thread must not wait on a full queue, it keeps the connection until there is room
+    return dispatch(connfd, served, false);
 }
 
 //-----------------------------------------------------------------------------------------------------------------
-slot_t* slot_create(char* uri) {
+void handle_metrics(conn_t* conn, int connfd) {
 
-    // allocate memory
-    slot_t* new_slot = (slot_t *)malloc(sizeof(slot_t));
-    new_slot->uri = (char* )malloc(strlen(uri) + 1);
+    // the stage histograms and status counters, then gauges only the server knows about
+    size_t len;
+    char* body = metrics_format(metrics_global, &len);
 
-    // set values
-    strcpy(new_slot->uri, uri);
-    new_slot->lock = rwlock_new(N_WAY, 1);
-    new_slot->num_workers = 0;
+    uint64_t hits = 0, misses = 0;
+    if (cache_global != NULL) {
+        cache_stats(cache_global, &hits, &misses);
+    }
 
-    return new_slot;
+    uint64_t gz_files, gz_in, gz_out, gz_cpu_ns;
+    gzip_stats(&gz_files, &gz_in, &gz_out, &gz_cpu_ns);
+
+    char gauges[2048];
+    int glen = snprintf(gauges, sizeof(gauges),
+        "# TYPE httpserver_pool_threads gauge\nhttpserver_pool_threads %d\n"
+        "# TYPE httpserver_pool_idle_threads gauge\nhttpserver_pool_idle_threads %d\n"
+        "# TYPE httpserver_pool_spawned_total counter\nhttpserver_pool_spawned_total %lu\n"
+        "# TYPE httpserver_pool_retired_total counter\nhttpserver_pool_retired_total %lu\n"
+        "# TYPE httpserver_requests_total counter\nhttpserver_requests_total %lu\n"
+        "# TYPE httpserver_slot_allocs_total counter\nhttpserver_slot_allocs_total %lu\n"
+        "# TYPE httpserver_cache_hits_total counter\nhttpserver_cache_hits_total %lu\n"
+        "# TYPE httpserver_cache_misses_total counter\nhttpserver_cache_misses_total %lu\n"
+        "# TYPE httpserver_gzip_files_total counter\nhttpserver_gzip_files_total %lu\n"
+        "# TYPE httpserver_gzip_input_bytes_total counter\nhttpserver_gzip_input_bytes_total %lu\n"
+        "# TYPE httpserver_gzip_output_bytes_total counter\nhttpserver_gzip_output_bytes_total %lu\n"
+        "# TYPE httpserver_gzip_cpu_seconds_total counter\nhttpserver_gzip_cpu_seconds_total %.6f\n",
+        atomic_load(&pool_size), atomic_load(&pool_idle), atomic_load(&pool_spawned),
+        atomic_load(&pool_retired), atomic_load(&requests_served), (unsigned long) slots_allocs(slots_global),
+        (unsigned long) hits,
+        (unsigned long) misses, (unsigned long) gz_files, (unsigned long) gz_in, (unsigned long) gz_out,
+        (double) gz_cpu_ns / 1e9);
+
+    char head[128];
+    int hlen = format_ok_header(head, sizeof(head), len + glen, NULL, NULL);
+
+    bool ok = write_n_bytes(connfd, head, hlen) == hlen && write_n_bytes(connfd, body, len) == (ssize_t) len
+        && write_n_bytes(connfd, gauges, glen) == glen;
+    free(body);
+
+    audit_log(conn, response_get_code(ok ? &RESPONSE_OK : &RESPONSE_INTERNAL_SERVER_ERROR), "GET");
 }
 
 //-----------------------------------------------------------------------------------------------------------------
-void slot_leave(int index) {
+void handle_request(conn_t* conn, int connfd, const Response_t* res) {
+
+    // only enter if statement if request is valid format
+    if (res == NULL) {
+
+        // get important request attributes
+        char* uri = conn_get_uri(conn);
+        const Request_t* req = conn_get_request(conn);
+
+        // initialize state variables and lock to be used, every GET and PUT is checked
+        // against the file system under its uri's lock, unsupported requests need none
+        slot_t* current_slot = NULL;
+        rwlock_t* current_lock = NULL;
+        bool locked = req == &REQUEST_GET || req == &REQUEST_PUT;
+
+        // the metrics page is not a file, it is answered without touching the slot table
+        if (req == &REQUEST_GET && strcmp(uri, METRICS_URI) == 0) {
+            handle_metrics(conn, connfd);
+            atomic_fetch_add_explicit(&requests_served, 1, memory_order_relaxed);
+            return;
+        }
 
-    // for readability
-    int n = index;
+        // nor may it be written, GET would never return the file
+        if (req == &REQUEST_PUT && strcmp(uri, METRICS_URI) == 0) {
+            handle_reserved(conn);
+            atomic_fetch_add_explicit(&requests_served, 1, memory_order_relaxed);
+            return;
+        }
+
+        if (locked) {
+            // join the slot for this uri, creating it if no other worker holds it
+            current_slot = slots_enter(slots_global, uri);
+            current_lock = slot_get_lock(current_slot);
+        }
+        // handle connection based on if method is GET, PUT, or unsupported using the current lock
+        handle_connection(conn, connfd, current_lock, res);
+        if (locked) {
+            slots_leave(slots_global, current_slot);
+        }
+        atomic_fetch_add_explicit(&requests_served, 1, memory_order_relaxed);
+    }
+    else {
+        // handle bad request
+        handle_bad_request(conn/*, res*/);
+    }
+}
 
+//-----------------------------------------------------------------------------------------------------------------
+bool keep_alive(conn_t* conn, const Response_t* res, int served) {
 
-    // leave the slot located at index n of the worker_slots array (if it active)
-    if (worker_slots[n]->num_workers > 0) {
+    // a malformed request leaves the stream out of sync, so we cannot parse another,
+    // and neither can we after a handler that answered without reading the whole body
+    if (res != NULL || conn_get_close(conn) || served >= keepalive_max) {
+        return false;
+    }
 
-        // acquire the mutex
-        pthread_mutex_lock(&mutex_global);
-        worker_slots[n]->num_workers -= 1;
+    // only a PUT reads its body, one sent along with anything else is still in the stream
+    char* length = conn_get_header(conn, "Content-Length");
+    if (conn_get_request(conn) != &REQUEST_PUT
+        && ((length != NULL && strtoull(length, NULL, 10) > 0) || conn_get_header(conn, "Transfer-Encoding") != NULL)) {
+        return false;
+    }
 
-        // if the slot is empty we must reset it
-        if (worker_slots[n]->num_workers == 0) {
+    // HTTP/1.1 connections are persistent unless the client asks otherwise
+    char* connection = conn_get_header(conn, "Connection");
+    if (connection != NULL && strcasecmp(connection, "close") == 0) {
+        return false;
+    }
 
-            rwlock_delete(&(worker_slots[n]->lock));
-            worker_slots[n]->lock = NULL;
+    return true;
+}
 
-            strcpy(worker_slots[n]->uri, "\0");
-        }
+//-----------------------------------------------------------------------------------------------------------------
+bool wait_next_request(conn_t* conn) {
 
-        // release the mutex
-        pthread_mutex_unlock(&mutex_global);
+    // a pipelined request is already buffered
+    if (conn_buffered(conn)) {
+        return true;
     }
+
+    // wait up to the idle timeout for the client to send something and read it straight
+    // into the next request, nothing to read means the client closed the connection
+    return conn_wait(conn, keepalive_idle);
 }
 
 //-----------------------------------------------------------------------------------------------------------------
@@ -302,8 +681,295 @@ void audit_log(conn_t* conn, uint16_t response_code, char* request_type) {
         id = "0";
     }
 
-    // output appropriate audit log
-    fprintf(stderr, "%s,/%s,%hu,%s\n", method, uri, code, id);
+    // append to this thread's log buffer, the writer thread does the actual write
+    auditlog_write(audit_global, method, uri, code, id);
+    metrics_status(metrics_global, code);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int format_ok_header(char* buf, size_t size, uint64_t count, struct stat* st, char* coding) {
+
+    // a file's validators let the client revalidate it later, st is NULL for generated bodies
+    char validators[VALIDATOR_LEN] = "";
+    if (st != NULL) {
+        validator_format(validators, sizeof(validators), st, coding);
+    }
+
+    // with -g a file's body depends on Accept-Encoding, shared caches must know that
+    char encoding[64] = "";
+    if (coding != NULL) {
+        snprintf(encoding, sizeof(encoding), "Content-Encoding: %s\r\nVary: Accept-Encoding\r\n", coding);
+    }
+    else if (gzip_mode && st != NULL) {
+        snprintf(encoding, sizeof(encoding), "Vary: Accept-Encoding\r\n");
+    }
+
+    // status line and headers of a 200 response with a count byte body
+    return snprintf(buf, size, "HTTP/1.1 %hu %s\r\nContent-Length: %lu\r\n%s%s\r\n",
+        response_get_code(&RESPONSE_OK), response_get_message(&RESPONSE_OK), (unsigned long) count, validators,
+        encoding);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+const Response_t* send_file(conn_t* conn, int connfd, int fd, uint64_t count, struct stat* st, char* coding) {
+
+    // conn_send_file writes its own headers, without a Content-Encoding
+    if (!zero_copy && coding == NULL) {
+        return conn_send_file(conn, fd, count);
+    }
+
+    // write the status line and headers ourselves so the body can go out with sendfile
+    char head[256];
+    int len = format_ok_header(head, sizeof(head), count, st, coding);
+
+    if (!send_part(connfd, fd, head, len, 0, count)) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool send_head(int connfd, char* buf, size_t len, bool more) {
+
+    // MSG_MORE lets the kernel coalesce the headers with the body that follows, without
+    // a body it would hold them back until its cork timer fires
+    for (size_t off = 0; off < len; ) {
+        ssize_t n = send(connfd, buf + off, len - off, (more ? MSG_MORE : 0) | MSG_NOSIGNAL);
+        if (n < 0 && errno != EINTR) {
+            return false;
+        }
+        off += n > 0 ? n : 0;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+bool send_part(int connfd, int fd, char* head, size_t len, uint64_t offset, uint64_t count) {
+
+    // the io_uring engine chains the header and the body into as few submissions as it can
+    if (uring_mode) {
+        return uring_send_file(fd, connfd, head, len, offset, count) == (ssize_t) count;
+    }
+
+    return send_head(connfd, head, len, count > 0) && send_n_bytes(fd, connfd, offset, count) == (ssize_t) count;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+const Response_t* send_not_modified(int connfd, struct stat* st, char* coding) {
+
+    // no body, just the validators the client should keep using
+    char validators[VALIDATOR_LEN];
+    validator_format(validators, sizeof(validators), st, coding);
+
+    char head[256];
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 %hu %s\r\n%s\r\n", response_get_code(&RESPONSE_NOT_MODIFIED),
+        response_get_message(&RESPONSE_NOT_MODIFIED), validators);
+
+    return write_n_bytes(connfd, head, len) == len ? &RESPONSE_NOT_MODIFIED : &RESPONSE_INTERNAL_SERVER_ERROR;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+const Response_t* send_ranges(int connfd, int fd, struct stat* st, range_t* ranges, int n) {
+
+    uint64_t size = st->st_size;
+    char head[384];
+    int len;
+
+    // nothing asked for exists, say how long the file is instead
+    if (n == 0) {
+        const Response_t* res = &RESPONSE_RANGE_NOT_SATISFIABLE;
+        len = snprintf(head, sizeof(head), "HTTP/1.1 %hu %s\r\nContent-Length: 0\r\nContent-Range: bytes */%lu\r\n\r\n",
+            response_get_code(res), response_get_message(res), (unsigned long) size);
+        return write_n_bytes(connfd, head, len) == len ? res : &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    // the parts come with the validators of the whole file
+    char validators[VALIDATOR_LEN];
+    validator_format(validators, sizeof(validators), st, NULL);
+
+    // a single range is sent bare, only Content-Range says which part it is
+    if (n == 1) {
+        len = snprintf(head, sizeof(head),
+            "HTTP/1.1 %hu %s\r\nContent-Length: %lu\r\nContent-Range: bytes %lu-%lu/%lu\r\n%s\r\n",
+            response_get_code(&RESPONSE_PARTIAL_CONTENT), response_get_message(&RESPONSE_PARTIAL_CONTENT),
+            (unsigned long) ranges[0].length, (unsigned long) ranges[0].offset,
+            (unsigned long) (ranges[0].offset + ranges[0].length - 1), (unsigned long) size, validators);
+        return send_part(connfd, fd, head, len, ranges[0].offset, ranges[0].length) ? &RESPONSE_PARTIAL_CONTENT
+            : &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    // several ranges go out as multipart/byteranges, every part header is built up front
+    // so that the Content-Length is known before anything is sent
+    char boundary[24];
+    snprintf(boundary, sizeof(boundary), "%016lx", (unsigned long) now_ns());
+
+    char parts[MAX_RANGES][128];
+    int part_len[MAX_RANGES];
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++) {
+        part_len[i] = snprintf(parts[i], sizeof(parts[i]), "%s--%s\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n",
+            i == 0 ? "" : "\r\n", boundary, (unsigned long) ranges[i].offset,
+            (unsigned long) (ranges[i].offset + ranges[i].length - 1), (unsigned long) size);
+        total += part_len[i] + ranges[i].length;
+    }
+
+    char tail[32];
+    int tail_len = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+    total += tail_len;
+
+    len = snprintf(head, sizeof(head),
+        "HTTP/1.1 %hu %s\r\nContent-Length: %lu\r\nContent-Type: multipart/byteranges; boundary=%s\r\n%s\r\n",
+        response_get_code(&RESPONSE_PARTIAL_CONTENT), response_get_message(&RESPONSE_PARTIAL_CONTENT),
+        (unsigned long) total, boundary, validators);
+
+    if (!send_head(connfd, head, len, true)) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!send_part(connfd, fd, parts[i], part_len[i], ranges[i].offset, ranges[i].length)) {
+            return &RESPONSE_INTERNAL_SERVER_ERROR;
+        }
+    }
+    if (write_n_bytes(connfd, tail, tail_len) != tail_len) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    return &RESPONSE_PARTIAL_CONTENT;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+const Response_t* recv_file(conn_t* conn, int connfd, int fd) {
+
+    // a chunked body has no length, it is decoded here whether or not we splice, and
+    // sending a length as well is the classic request smuggling setup, every error
+    // return leaves body bytes unread, so the caller must not reuse the connection
+    char* length_str = conn_get_header(conn, "Content-Length");
+    char* encoding = conn_get_header(conn, "Transfer-Encoding");
+    if (encoding != NULL) {
+        if (strcasecmp(encoding, "chunked") != 0) {
+            return &RESPONSE_NOT_IMPLEMENTED;
+        }
+        if (length_str != NULL) {
+            return &RESPONSE_BAD_REQUEST;
+        }
+        return recv_chunked(conn, connfd, fd);
+    }
+
+    // without a length we cannot tell splice where the body ends
+    if (!zero_copy || length_str == NULL) {
+        return conn_recv_file(conn, fd);
+    }
+
+    char* endptr = NULL;
+    size_t length = (size_t) strtoull(length_str, &endptr, 10);
+    if (endptr == length_str || *endptr != '\0') {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    // conn may already hold the start of the body, the rest is still on the socket
+    ssize_t buffered = conn_recv_buffered(conn, fd, length);
+    if (buffered < 0) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    ssize_t moved = splice_n_bytes(connfd, fd, length - buffered);
+    if (moved < 0) {
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+    if ((size_t) moved != length - buffered) {
+        return &RESPONSE_BAD_REQUEST;
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+const Response_t* recv_chunked(conn_t* conn, int connfd, int fd) {
+
+    // the framing is peeked and only bytes of this body are consumed, so a pipelined
+    // request behind it is left where the next conn will find it
+    chunked_t ch;
+    chunked_init(&ch);
+    char buf[CHUNK_PEEK];
+    bool buffered = true;
+
+    while (!chunked_done(&ch)) {
+
+        // payload past what we peeked goes straight from the socket to the file
+        if (ch.remaining > 0 && !buffered) {
+            ssize_t moved = zero_copy ? splice_n_bytes(connfd, fd, ch.remaining)
+                : pass_n_bytes(connfd, fd, ch.remaining);
+            if (moved < 0) {
+                return &RESPONSE_INTERNAL_SERVER_ERROR;
+            }
+            if ((uint64_t) moved != ch.remaining) {
+                return &RESPONSE_BAD_REQUEST;
+            }
+            chunked_take(&ch, moved);
+            continue;
+        }
+
+        // conn may already hold the start of the body, the rest is still on the socket
+        ssize_t n;
+        if (buffered) {
+            n = conn_peek_buffered(conn, buf, sizeof(buf));
+            if (n == 0) {
+                buffered = false;
+                continue;
+            }
+        }
+        else {
+            n = recv(connfd, buf, sizeof(buf), MSG_PEEK);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                return &RESPONSE_BAD_REQUEST;
+            }
+        }
+        if (n < 0) {
+            return &RESPONSE_INTERNAL_SERVER_ERROR;
+        }
+
+        // walk the framing, writing out any payload that came along with it
+        size_t used = 0;
+        while (used < (size_t) n && !chunked_done(&ch)) {
+            ssize_t framing = chunked_parse(&ch, buf + used, n - used);
+            if (framing < 0) {
+                return &RESPONSE_BAD_REQUEST;
+            }
+            used += framing;
+
+            if (ch.remaining > 0 && used < (size_t) n) {
+                size_t take = n - used < ch.remaining ? n - used : ch.remaining;
+                if (write_n_bytes(fd, buf + used, take) != (ssize_t) take) {
+                    return &RESPONSE_INTERNAL_SERVER_ERROR;
+                }
+                chunked_take(&ch, take);
+                used += take;
+            }
+        }
+
+        // consume exactly what was parsed, it is already sitting there
+        if (buffered) {
+            conn_skip_buffered(conn, used);
+            continue;
+        }
+        for (size_t off = 0; off < used; ) {
+            ssize_t got = recv(connfd, buf, used - off, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return &RESPONSE_INTERNAL_SERVER_ERROR;
+            }
+            off += got;
+        }
+    }
+
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------------------------------------------
@@ -314,24 +980,78 @@ char* get_threads(int argc, char** argv) {
     char* threads_str = NULL;
 
     // check number of arguments
-    if (argc < 2 || argc > 4) {
+    if (argc < 2) {
         fprintf(stderr, "wrong arguments: %s threads port_num\n", argv[0]);
-        fprintf(stderr, "usage: %s [-t threads] <port>\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0]);
         exit(1);
     }
 
-    // get opt to check -t flag
-    while ((opt = getopt(argc, argv, "t:")) != -1) {
+    // get opt to check -t flag, the keep-alive flags and the reactor flag
+    while ((opt = getopt(argc, argv, "t:m:r:a:Pq:k:i:seZURc:l:pg")) != -1) {
         switch(opt) {
             case 't':
                 threads_str = optarg;
                 break;
+            case 'm':
+                pool_min = atoi(optarg);
+                break;
+            case 'r':
+                pool_retire_ms = atoi(optarg);
+                break;
+            case 'a':
+                acceptors = atoi(optarg);
+                break;
+            case 'P':
+                reuseport_mode = true;
+                break;
+            case 'q':
+                queue_depth = atoi(optarg);
+                break;
+            case 'k':
+                keepalive_max = atoi(optarg);
+                break;
+            case 'i':
+                keepalive_idle = atoi(optarg);
+                break;
+            case 's':
+                steal_mode = true;
+                break;
+            case 'e':
+                reactor_mode = true;
+                break;
+            case 'Z':
+                zero_copy = false;
+                break;
+            case 'U':
+                uring_mode = true;
+                break;
+            case 'R':
+                conn_use_regex(true);
+                break;
+            case 'g':
+                gzip_mode = true;
+                break;
+            case 'c':
+                cache_mb = (size_t) strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                log_path = optarg;
+                break;
+            case 'p':
+                lock_profile = true;
+                break;
             default:
-                fprintf(stderr, "usage: %s [-t threads] <port>\n", argv[0]);
+                fprintf(stderr, USAGE, argv[0]);
                 exit(1);
         }
     }
 
+    // exactly one positional argument, the port
+    if (optind != argc - 1) {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(1);
+    }
+
     // NULL or threads string
     return threads_str;
 }
@@ -361,9 +1081,14 @@ int check_args(int argc, char** argv, char* threads_str, int threads) {
     }
 
     // check number of arguments
-    if (argc < 2 || argc > 4) {
+    // without -m the pool is fixed, and the work-stealing scheduler always has one worker per local queue
+    if (pool_min == 0 || steal_mode) {
+        pool_min = threads;
+    }
+
+    if (argc < 2 || threads < 1 || pool_min < 1 || pool_min > threads || pool_retire_ms < 1 || acceptors < 1 || queue_depth < 1 || keepalive_max < 1 || keepalive_idle < 0) {
         fprintf(stderr, "wrong arguments: %s threads port_num\n", argv[0]);
-        fprintf(stderr, "usage: %s [-t threads] <port>\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0]);
         exit(1);
     }
 
@@ -371,67 +1096,29 @@ int check_args(int argc, char** argv, char* threads_str, int threads) {
 }
 
 //-----------------------------------------------------------------------------------------------------------------
-bool check_validity (conn_t* conn, bool* existed) {
-    // init
-    char *uri = conn_get_uri(conn);
-    const Request_t *req = conn_get_request(conn);
-    int fd = 0;
-    bool check = true;
-
-    // check if file exists.  
-    bool ex = (access(uri, F_OK)) == 0;
-    (*existed) = ex;
-
-    if (req == &REQUEST_PUT) {
-
-        // open the file
-        fd = open(uri, O_CREAT | O_TRUNC | O_WRONLY, 0600);
-
-        // handle invalid PUT
-        if (fd < 0) {
-            check = false;
-        }
-        else {
-            check = true;
-        }
-    }
-    else if (req == &REQUEST_GET) {
-
-        // open the file
-        fd = open(uri, O_RDWR, 0600);
-
-        // invalid GET
-        if (fd < 0) {
-            check = false;
-        }
-        //valid GET
-        else {
-            check = true;
-        }
-    }
-    else {
-        check = false;
-    }
-
-    close(fd);
-    return check;
-}
-
-//-----------------------------------------------------------------------------------------------------------------
-void handle_connection(conn_t* conn, rwlock_t* lock, const Response_t* res, bool* existed) {
+void handle_connection(conn_t* conn, int connfd, rwlock_t* lock, const Response_t* res) {
 
     if (res != NULL) {
         conn_send_response(conn, res);
     } else {
         const Request_t *req = conn_get_request(conn);
         if (req == &REQUEST_PUT) {
-            writer_lock(lock);
-            handle_put(conn, lock, existed);
-            writer_unlock(lock);
+            // takes the writer lock itself, only around the commit
+            handle_put(conn, connfd, lock);
         }
         else if (req == &REQUEST_GET) {
+            uint64_t start = now_ns();
             reader_lock(lock);
-            handle_get(conn, lock);
+            metrics_record(metrics_global, STAGE_LOCK, now_ns() - start);
+
+            // a cache hit needs no file at all, otherwise the file is opened exactly once
+            if (!handle_get_cached(conn, connfd)) {
+                struct stat st;
+                start = now_ns();
+                int fd = open_file(conn_get_uri(conn), &st);
+                metrics_record(metrics_global, STAGE_IO, now_ns() - start);
+                handle_get(conn, connfd, fd, &st);
+            }
             reader_unlock(lock);
         }
         else if (req == &REQUEST_UNSUPPORTED) {
@@ -439,24 +1126,80 @@ void handle_connection(conn_t* conn, rwlock_t* lock, const Response_t* res, bool
         }
     }
 
-    conn_delete(&conn);
 }
 
 //-----------------------------------------------------------------------------------------------------------------
-void handle_get(conn_t* conn, rwlock_t* lock) {
+bool handle_get_cached(conn_t* conn, int connfd) {
+
+    // the cache is only consistent with the file while we hold the uri's lock
+    if (cache_global == NULL) {
+        return false;
+    }
+
+    // it only holds whole responses, range and conditional requests need the file's attributes
+    if (conn_get_header(conn, "Range") != NULL || conn_get_header(conn, "If-None-Match") != NULL
+        || conn_get_header(conn, "If-Modified-Since") != NULL) {
+        return false;
+    }
+
+    // a hit is a single write of the prebuilt response
+    char key[MAX_URI_LEN + 8];
+    bool gzip = gzip_mode && gzip_accepted(conn_get_header(conn, "Accept-Encoding"));
+    cache_entry_t* entry = cache_get(cache_global, cache_key(key, sizeof(key), conn_get_uri(conn), gzip));
+    if (entry == NULL) {
+        return false;
+    }
+
+    uint64_t start = now_ns();
+    const Response_t* res = cache_entry_send(entry, connfd) < 0 ? &RESPONSE_INTERNAL_SERVER_ERROR : &RESPONSE_OK;
+    metrics_record(metrics_global, STAGE_SEND, now_ns() - start);
+    cache_release(cache_global, entry);
+    audit_log(conn, response_get_code(res), "GET");
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+char* cache_key(char* buf, size_t size, char* uri, bool gzip) {
+
+    // clients that take gzip get an entry of their own, holding whatever they are sent
+    if (!gzip) {
+        return uri;
+    }
+    gzip_path(buf, size, uri);
+
+    return buf;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int open_file(char* uri, struct stat* st) {
+
+    // with io_uring the open and the stat go to the kernel in one submission
+    if (uring_mode) {
+        return uring_open(uri, O_RDONLY | O_CLOEXEC, st);
+    }
+
+    int fd = open(uri, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && fstat(fd, st) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void handle_get(conn_t* conn, int connfd, int fd, struct stat* st) {
     // // init
     const Response_t* res = NULL;
     char *uri = conn_get_uri(conn);
 
-    // check if file exists.  
-    bool existed = (access(uri, F_OK)) == 0;
-
-    // open the file
-    int fd = open(uri, O_RDWR, 0600);
-
-    // handle invalid GET
-    if (fd < 0) {
-        if (existed || errno == EISDIR) {
+    // st, used to calculate file size, was filled in when fd was opened
+    // handle invalid GET, errno is still the one from opening fd
+    if (fd < 0 || S_ISDIR(st->st_mode)) {
+        if (fd >= 0 || errno == EACCES || errno == EISDIR) {
             res = &RESPONSE_FORBIDDEN;
         }
         else if (errno == ENOENT) {
@@ -465,63 +1208,190 @@ void handle_get(conn_t* conn, rwlock_t* lock) {
         else {
             res = &RESPONSE_INTERNAL_SERVER_ERROR;
         }
+
+        conn_send_response(conn, res);
+        audit_log(conn, response_get_code(res), "GET");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
     }
     
-    // handle valid GET
+    // handle valid GET, filling the cache counts as sending since it reads the whole file,
+    // and so does creating a gzip sidecar
+    cache_entry_t* entry = NULL;
+    uint64_t start = now_ns();
+
+    // a client that takes gzip gets the compressed sidecar if it is smaller, ranges are
+    // always served from the file itself since their offsets refer to it
+    char* range = conn_get_header(conn, "Range");
+    bool gzip = gzip_mode && gzip_accepted(conn_get_header(conn, "Accept-Encoding"));
+    char* coding = NULL;
+    int body = fd;
+    uint64_t body_len = st->st_size;
+
+    if (gzip && range == NULL && st->st_size >= GZIP_MIN_SIZE) {
+        struct stat gz_st;
+        int gz = gzip_open(uri, fd, st, &gz_st);
+        if (gz >= 0 && gz_st.st_size < st->st_size) {
+            coding = "gzip";
+            body = gz;
+            body_len = gz_st.st_size;
+        }
+        else if (gz >= 0) {
+            close(gz);
+        }
+    }
 
-    // stat struct used to calculate file size  
-    struct stat fstat;
-    stat(uri, &fstat);
+    // a Range we understand gets only the parts asked for (or a 416), one we do not
+    // understand is ignored and the whole file is sent
+    range_t ranges[MAX_RANGES];
+    int n = range == NULL ? -1 : range_parse(range, st->st_size, ranges, MAX_RANGES);
 
-    reader_lock(lock)
-    res = conn_send_file(conn, fd, fstat.st_size);
+    // the client's copy is still current, only the validators go back
+    if (validator_not_modified(st, coding, conn_get_header(conn, "If-None-Match"),
+            conn_get_header(conn, "If-Modified-Since"))) {
+        res = send_not_modified(connfd, st, coding);
+    }
+    else if (n >= 0) {
+        res = send_ranges(connfd, fd, st, ranges, n);
+    }
+    else {
+        // on a miss cache the response, if it fits, and send it from there
+        if (cache_global != NULL) {
+            char key[MAX_URI_LEN + 8];
+            char head[256];
+            int len = format_ok_header(head, sizeof(head), body_len, st, coding);
+            entry = cache_insert(cache_global, cache_key(key, sizeof(key), uri, gzip), head, len, body, body_len);
+        }
 
-    if (res == NULL && existed) {
-        res = &RESPONSE_OK;
+        if (entry != NULL) {
+            res = cache_entry_send(entry, connfd) < 0 ? &RESPONSE_INTERNAL_SERVER_ERROR : &RESPONSE_OK;
+            cache_release(cache_global, entry);
+        }
+        else {
+            res = send_file(conn, connfd, body, body_len, st, coding);
+            res = res == NULL ? &RESPONSE_OK : res;
+        }
     }
+    metrics_record(metrics_global, STAGE_SEND, now_ns() - start);
     audit_log(conn, response_get_code(res), "GET");
-    reader_unlock(lock);
-    
+
+    if (body != fd) {
+        close(body);
+    }
     close(fd);
 }
 
 //-----------------------------------------------------------------------------------------------------------------
-void handle_put(conn_t* conn, rwlock_t* lock, bool* existed) {
+void handle_put(conn_t* conn, int connfd, rwlock_t* lock) {
 
     //init
     const Response_t* res = NULL;
     char *uri = conn_get_uri(conn);
+    bool existed = false;
 
-    // open the file
-    int fd = open(uri, O_TRUNC | O_WRONLY, 0600);
+    // stream the body into a temp file without holding the lock, readers
+    // keep getting the old version of the file for the whole upload
+    char tmp[32];
+    uint64_t start = now_ns();
+    int fd = put_tmp_open(tmp, sizeof(tmp));
 
-    // handle invalid PUT
     if (fd < 0) {
-        // fprintf(stderr, "%s: %d", uri, errno);
-        if (errno == EACCES || errno == EISDIR || errno == ENOENT) {
-            res = &RESPONSE_FORBIDDEN;
-        }
-        else {
-            res = &RESPONSE_INTERNAL_SERVER_ERROR;
+        // nowhere to put the body, so it stays on the socket and the connection cannot be reused
+        res = &RESPONSE_INTERNAL_SERVER_ERROR;
+        conn_set_close(conn);
+    }
+    else {
+        res = recv_file(conn, connfd, fd);
+
+        // the body was not read to its end, and what is left of it is no request
+        if (res != NULL) {
+            conn_set_close(conn);
         }
     }
-    
-    // handle valid PUT
+    uint64_t io_ns = now_ns() - start;
+
+    // the rename is the linearization point of the PUT, so it and the audit
+    // log entry are all that happen under the writer lock
+    start = now_ns();
     writer_lock(lock);
-    res = conn_recv_file(conn, fd);
+    metrics_record(metrics_global, STAGE_LOCK, now_ns() - start);
+
+    start = now_ns();
+    if (res == NULL) {
+        res = put_commit(uri, tmp, fd, &existed);
+    }
+    metrics_record(metrics_global, STAGE_IO, io_ns + now_ns() - start);
+
+    if (res == NULL) {
+        res = existed ? &RESPONSE_OK : &RESPONSE_CREATED;
 
-    if (res == NULL && (*existed)) {
-        res = &RESPONSE_OK;
+        // any cached copy or compressed sidecar is stale from here on
+        if (cache_global != NULL) {
+            char key[MAX_URI_LEN + 8];
+            cache_invalidate(cache_global, uri);
+            cache_invalidate(cache_global, cache_key(key, sizeof(key), uri, true));
+        }
+        if (gzip_mode) {
+            gzip_invalidate(uri);
+        }
     }
-    else if (res == NULL && !(*existed)) {
-        res = &RESPONSE_CREATED;
+    else if (fd >= 0) {
+        unlink(tmp);
     }
 
-    conn_send_response(conn, res);
     audit_log(conn, response_get_code(res), "PUT");
     writer_unlock(lock);
 
-    close(fd);
+    start = now_ns();
+    conn_send_response(conn, res);
+    metrics_record(metrics_global, STAGE_SEND, now_ns() - start);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int put_tmp_open(char* path, size_t size) {
+
+    // '_' cannot appear in a uri, so temp files never collide with (or are served as) targets
+    int fd = -1;
+    do {
+        unsigned long n = atomic_fetch_add(&put_tmp_counter, 1);
+        snprintf(path, size, ".put_%lu", n);
+        fd = open(path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    } while (fd < 0 && errno == EEXIST);
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+const Response_t* put_commit(char* uri, char* tmp, int fd, bool* existed) {
+
+    // check the target now that we hold its lock
+    struct stat st;
+    (*existed) = stat(uri, &st) == 0;
+
+    if ((*existed) && (S_ISDIR(st.st_mode) || access(uri, W_OK) != 0)) {
+        return &RESPONSE_FORBIDDEN;
+    }
+
+    // the new version keeps the permissions of the one it replaces (temp files start as 0600)
+    if ((*existed) && (st.st_mode & 07777) != 0600) {
+        fchmod(fd, st.st_mode & 07777);
+    }
+
+    // atomically swap the new version in
+    if (rename(tmp, uri) < 0) {
+        if (errno == EACCES || errno == EISDIR || errno == ENOENT) {
+            return &RESPONSE_FORBIDDEN;
+        }
+        return &RESPONSE_INTERNAL_SERVER_ERROR;
+    }
+
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------------------------------------------
@@ -529,21 +1399,127 @@ void handle_unsupported(conn_t* conn) {
 
     // simply send unsupported response
     conn_send_response(conn, &RESPONSE_NOT_IMPLEMENTED);
+    metrics_status(metrics_global, response_get_code(&RESPONSE_NOT_IMPLEMENTED));
 }   
 
+//-----------------------------------------------------------------------------------------------------------------
+void handle_reserved(conn_t* conn) {
+
+    // the body is left unread, so it cannot be followed by another request
+    conn_set_close(conn);
+    audit_log(conn, response_get_code(&RESPONSE_FORBIDDEN), "PUT");
+    conn_send_response(conn, &RESPONSE_FORBIDDEN);
+}
+
 //-----------------------------------------------------------------------------------------------------------------
 void handle_bad_request(conn_t* conn/*, const Response_t* res*/) {
 
     // simply send bad request response
     conn_send_response(conn, &RESPONSE_BAD_REQUEST);
+    metrics_status(metrics_global, response_get_code(&RESPONSE_BAD_REQUEST));
 }   
 
 //-----------------------------------------------------------------------------------------------------------------
-void print_worker_slots(slot_t** ws, int num_threads) {
-
-    for (int i = 0; i < num_threads; i ++) {
-        printf("Slot %d: URI: %s, Waiting: %d\n", i, ws[i]->uri, ws[i]->num_workers);
+void print_worker_slots(slots_t* slots) {
+
+    slots_print(slots);
+
+    // heap allocations on the slot path per request served, 0 in steady state
+    unsigned long allocs = slots_allocs(slots);
+    unsigned long served = atomic_load(&requests_served);
+    printf("Slot allocations: %lu, Requests: %lu, Per request: %.6f\n", allocs, served,
+        served == 0 ? 0.0 : (double) allocs / (double) served);
+
+    // how long connections waited in the queue for a worker
+    uint64_t waits, wait_ns;
+    uint64_t p50 = metrics_quantile(metrics_global, STAGE_QUEUE, 0.50, &waits, &wait_ns);
+    uint64_t p99 = metrics_quantile(metrics_global, STAGE_QUEUE, 0.99, &waits, &wait_ns);
+    printf("Queue waits: %lu, Mean: %.1fus, p50: %.1fus, p99: %.1fus\n", (unsigned long) waits,
+        waits == 0 ? 0.0 : (double) wait_ns / (double) waits / 1000.0, (double) p50 / 1000.0,
+        (double) p99 / 1000.0);
+
+    printf("Pool size: %d (min %d, max %d), Idle: %d, Spawned: %lu, Retired: %lu\n",
+        atomic_load(&pool_size), pool_min, pool_max, atomic_load(&pool_idle),
+        atomic_load(&pool_spawned), atomic_load(&pool_retired));
+
+    if (cache_global != NULL) {
+        uint64_t hits, misses;
+        cache_stats(cache_global, &hits, &misses);
+        printf("Cache hits: %lu, Cache misses: %lu\n", (unsigned long) hits, (unsigned long) misses);
     }
+    fflush(stdout);
 }   
 
 //-----------------------------------------------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------------------------------------------
+void* signal_exec(void* args) {
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    if (lock_profile || debug_stats) {
+        sigaddset(&set, SIGUSR1);
+    }
+
+    // signals are handled here rather than in a signal handler, so we may take locks and allocate
+    while (1) {
+        int sig;
+        if (sigwait(&set, &sig) != 0) {
+            continue;
+        }
+        if (sig != SIGUSR1) {
+            atomic_store(&stopping, true);
+            for (int i = 0; i < num_listeners; i++) {
+                ls_shutdown(listeners_global[i]);
+            }
+            break;
+        }
+        if (debug_stats) {
+            print_worker_slots(slots_global);
+        }
+        if (lock_profile) {
+            profile_dump();
+        }
+    }
+
+    return args;
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+int profile_cmp(const void* a, const void* b) {
+
+    // most total wait first
+    const rwlock_stats_t* x = &((const slots_profile_t* ) a)->stats;
+    const rwlock_stats_t* y = &((const slots_profile_t* ) b)->stats;
+    uint64_t wx = x->read_wait_ns + x->write_wait_ns;
+    uint64_t wy = y->read_wait_ns + y->write_wait_ns;
+
+    return (wx < wy) - (wx > wy);
+}
+
+//-----------------------------------------------------------------------------------------------------------------
+void profile_dump(void) {
+
+    // snapshot every uri's profile, plus what the slots still in use have gathered
+    slots_profile_t* all;
+    size_t count = slots_profile(slots_global, &all);
+
+    qsort(all, count, sizeof(slots_profile_t), profile_cmp);
+
+    printf("Lock profile: %zu uris, top %d by total wait\n", count, PROFILE_TOP);
+    printf("%-24s %10s %10s %10s %10s %12s %12s %12s %12s %12s\n", "URI", "reads", "writes", "r.waits",
+        "w.waits", "r.wait(us)", "w.wait(us)", "r.hold(us)", "w.hold(us)", "max.wait(us)");
+    for (size_t i = 0; i < count && i < PROFILE_TOP; i++) {
+        rwlock_stats_t* st = &all[i].stats;
+        printf("/%-23s %10lu %10lu %10lu %10lu %12.1f %12.1f %12.1f %12.1f %12.1f\n", all[i].uri,
+            (unsigned long) st->reads, (unsigned long) st->writes, (unsigned long) st->read_waits,
+            (unsigned long) st->write_waits, (double) st->read_wait_ns / 1000.0,
+            (double) st->write_wait_ns / 1000.0, (double) st->read_hold_ns / 1000.0,
+            (double) st->write_hold_ns / 1000.0, (double) st->max_wait_ns / 1000.0);
+    }
+    fflush(stdout);
+
+    free(all);
+}
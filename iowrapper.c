@@ -0,0 +1,71 @@
+#include "iowrapper.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+// bytes pass_n_bytes moves per read
+#define PASS_BUF 65536
+
+ssize_t read_n_bytes(int in, char buf[], size_t n) {
+    size_t total = 0;
+
+    while (total < n) {
+        ssize_t got = read(in, buf + total, n - total);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        total += got;
+    }
+
+    return total;
+}
+
+ssize_t write_n_bytes(int out, char buf[], size_t n) {
+    size_t total = 0;
+
+    while (total < n) {
+        ssize_t put = write(out, buf + total, n - total);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return -1;
+        }
+        total += put;
+    }
+
+    return total;
+}
+
+ssize_t pass_n_bytes(int src, int dst, size_t n) {
+    char buf[PASS_BUF];
+    size_t total = 0;
+
+    while (total < n) {
+        size_t want = n - total < sizeof(buf) ? n - total : sizeof(buf);
+
+        ssize_t got = read(src, buf, want);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+
+        if (write_n_bytes(dst, buf, got) != got) {
+            return -1;
+        }
+        total += got;
+    }
+
+    return total;
+}
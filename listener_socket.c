@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+
+#include "listener_socket.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// seconds a connection may block in a read before the read fails
+#define ACCEPT_TIMEOUT_S 5
+
+#define LISTEN_BACKLOG 1024
+
+struct Listener_Socket {
+    int fd;
+};
+
+static Listener_Socket_t *listen_on(int port, bool reuseport) {
+    if (port < 1 || port > 65535) {
+        return NULL;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) port);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, LISTEN_BACKLOG) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    Listener_Socket_t *pls = (Listener_Socket_t *) malloc(sizeof(Listener_Socket_t));
+    pls->fd = fd;
+
+    return pls;
+}
+
+Listener_Socket_t *ls_new(int port) {
+    return listen_on(port, false);
+}
+
+Listener_Socket_t *ls_new_reuseport(int port) {
+    return listen_on(port, true);
+}
+
+void ls_delete(Listener_Socket_t **ppls) {
+    if (*ppls == NULL) {
+        return;
+    }
+
+    close((*ppls)->fd);
+    free(*ppls);
+    *ppls = NULL;
+}
+
+void ls_shutdown(Listener_Socket_t *pls) {
+    shutdown(pls->fd, SHUT_RDWR);
+}
+
+int ls_accept(Listener_Socket_t *pls) {
+    int connfd;
+    do {
+        connfd = accept4(pls->fd, NULL, NULL, SOCK_CLOEXEC);
+    } while (connfd < 0 && errno == EINTR);
+
+    if (connfd < 0) {
+        return -1;
+    }
+
+    struct timeval tv = { .tv_sec = ACCEPT_TIMEOUT_S, .tv_usec = 0 };
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    return connfd;
+}
@@ -12,6 +12,18 @@ typedef struct Listener_Socket Listener_Socket_t;
  */
 Listener_Socket_t *ls_new(int port);
 
+/** @brief Initializes a listener socket like ls_new, with SO_REUSEPORT
+ *         set, so that several of them can listen on the same port.  The
+ *         kernel spreads new connections across them by a hash of the
+ *         client's address and port.
+ *
+ *  @param port The port on which to listen.
+ *
+ *  @return a pointer to the listener socket, indicating success, or NULL,
+ *          indicating that it failed to listen.
+ */
+Listener_Socket_t *ls_new_reuseport(int port);
+
 /** @brief Destory the listener socket.
  *
  *  @param ppls a pointer to the pointer to destory.  Cleans its memory and
@@ -20,6 +32,13 @@ Listener_Socket_t *ls_new(int port);
  */
 void ls_delete(Listener_Socket_t **ppls);
 
+/** @brief Stop accepting connections.  Threads blocked in ls_accept
+ *         return -1, and so does every later call.
+ *
+ *  @param pls A pointer to the Listener_Socket to stop.
+ */
+void ls_shutdown(Listener_Socket_t *pls);
+
 /** @brief Accept a new connection and initialize a 5 second timeout
  *
  *  @param pls A pointer to the Listener_Socket from which to get the new
@@ -0,0 +1,266 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+
+// log-linear buckets: 2^SUB_BITS per power of two nanoseconds, up to 2^MAX_EXP ns (about 137s)
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_EXP 37
+#define HIST_BUCKETS ((MAX_EXP - SUB_BITS + 1) * SUB_BUCKETS)
+
+// status codes 100 through 599
+#define MIN_CODE 100
+#define NUM_CODES 500
+
+// the exported histogram has one bucket per power of two from 2^MIN_LE ns (about 1us)
+#define MIN_LE 10
+
+static const char *stage_names[NUM_STAGES] = {
+    "accept", "queue", "parse", "lock", "io", "send", "total"
+};
+
+// one thread's counters, it is the only writer, so updates are a plain load and
+// store and the exporter reads them with relaxed loads
+struct local {
+    atomic_ulong hist[NUM_STAGES][HIST_BUCKETS];
+    atomic_ulong sum[NUM_STAGES];
+    atomic_ulong codes[NUM_CODES];
+
+    atomic_bool owned;
+    struct local *next;
+};
+
+struct metrics {
+    pthread_mutex_t lock;
+    _Atomic(struct local *) locals;
+    pthread_key_t key;
+};
+
+typedef struct metrics metrics_t;
+
+// a growable string for the exporter
+struct text {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static _Thread_local struct local *tls_local;
+
+static void local_release(void *arg) {
+    // counts stay with the metrics, the next new thread keeps adding to them
+    struct local *l = (struct local *) arg;
+    atomic_store(&(l->owned), false);
+}
+
+static struct local *local_get(metrics_t *m) {
+    if (tls_local != NULL) {
+        return tls_local;
+    }
+
+    pthread_mutex_lock(&(m->lock));
+
+    struct local *l = atomic_load(&(m->locals));
+    while (l != NULL && atomic_load(&(l->owned))) {
+        l = l->next;
+    }
+
+    if (l == NULL) {
+        l = (struct local *) calloc(1, sizeof(struct local));
+        l->next = atomic_load(&(m->locals));
+        atomic_store(&(m->locals), l);
+    }
+    atomic_store(&(l->owned), true);
+
+    pthread_mutex_unlock(&(m->lock));
+
+    pthread_setspecific(m->key, l);
+    tls_local = l;
+
+    return l;
+}
+
+static void bump(atomic_ulong *counter, unsigned long n) {
+    unsigned long v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + n, memory_order_relaxed);
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns < SUB_BUCKETS) {
+        return (int) ns;
+    }
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - SUB_BITS;
+    int bucket = (shift + 1) * SUB_BUCKETS + (int) ((ns >> shift) & (SUB_BUCKETS - 1));
+
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+static uint64_t bucket_top(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return (uint64_t) bucket;
+    }
+
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t base = (uint64_t) (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+
+    return base + ((1ull << shift) - 1);
+}
+
+// sum every thread's copy of one stage
+static void merge(metrics_t *m, STAGE stage, uint64_t *hist, uint64_t *sum_ns) {
+    memset(hist, 0, sizeof(uint64_t) * HIST_BUCKETS);
+    *sum_ns = 0;
+
+    for (struct local *l = atomic_load(&(m->locals)); l != NULL; l = l->next) {
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            hist[b] += atomic_load_explicit(&(l->hist[stage][b]), memory_order_relaxed);
+        }
+        *sum_ns += atomic_load_explicit(&(l->sum[stage]), memory_order_relaxed);
+    }
+}
+
+static void text_printf(struct text *t, const char *fmt, ...) {
+    while (1) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(t->data + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+
+        if (n >= 0 && (size_t) n < t->cap - t->len) {
+            t->len += (size_t) n;
+            return;
+        }
+
+        t->cap = t->cap * 2 + (n > 0 ? (size_t) n : 0);
+        t->data = realloc(t->data, t->cap);
+    }
+}
+
+metrics_t *metrics_new(void) {
+    metrics_t *m = (metrics_t *) malloc(sizeof(metrics_t));
+
+    pthread_mutex_init(&(m->lock), NULL);
+    atomic_init(&(m->locals), NULL);
+    pthread_key_create(&(m->key), local_release);
+
+    return m;
+}
+
+void metrics_delete(metrics_t **m) {
+    struct local *next;
+    for (struct local *l = atomic_load(&((*m)->locals)); l != NULL; l = next) {
+        next = l->next;
+        free(l);
+    }
+
+    pthread_key_delete((*m)->key);
+    pthread_mutex_destroy(&((*m)->lock));
+    free(*m);
+    *m = NULL;
+}
+
+void metrics_record(metrics_t *m, STAGE stage, uint64_t ns) {
+    if (m == NULL) {
+        return;
+    }
+
+    struct local *l = local_get(m);
+    bump(&(l->hist[stage][bucket_of(ns)]), 1);
+    bump(&(l->sum[stage]), ns);
+}
+
+void metrics_status(metrics_t *m, uint16_t code) {
+    if (m == NULL || code < MIN_CODE || code >= MIN_CODE + NUM_CODES) {
+        return;
+    }
+
+    struct local *l = local_get(m);
+    bump(&(l->codes[code - MIN_CODE]), 1);
+}
+
+uint64_t metrics_quantile(metrics_t *m, STAGE stage, double q, uint64_t *count, uint64_t *sum_ns) {
+    uint64_t hist[HIST_BUCKETS];
+    merge(m, stage, hist, sum_ns);
+
+    *count = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        *count += hist[b];
+    }
+    if (*count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (q * (double) *count);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= rank) {
+            return bucket_top(b);
+        }
+    }
+
+    return bucket_top(HIST_BUCKETS - 1);
+}
+
+char *metrics_format(metrics_t *m, size_t *len) {
+    struct text t = { (char *) malloc(16384), 0, 16384 };
+    uint64_t hist[HIST_BUCKETS];
+
+    text_printf(&t, "# HELP httpserver_stage_seconds Time requests spend in each stage.\n");
+    text_printf(&t, "# TYPE httpserver_stage_seconds histogram\n");
+
+    for (int s = 0; s < NUM_STAGES; s++) {
+        uint64_t sum_ns;
+        merge(m, (STAGE) s, hist, &sum_ns);
+
+        // a power of two is a bucket boundary, so the count below it is exact
+        uint64_t below = 0;
+        int b = 0;
+        for (int e = MIN_LE; e <= MAX_EXP; e++) {
+            int edge = (e - SUB_BITS + 1) * SUB_BUCKETS;
+            for (; b < edge && b < HIST_BUCKETS; b++) {
+                below += hist[b];
+            }
+            text_printf(&t, "httpserver_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %lu\n",
+                stage_names[s], (double) (1ull << e) / 1e9, (unsigned long) below);
+        }
+        for (; b < HIST_BUCKETS; b++) {
+            below += hist[b];
+        }
+
+        text_printf(&t, "httpserver_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", stage_names[s],
+            (unsigned long) below);
+        text_printf(&t, "httpserver_stage_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[s],
+            (double) sum_ns / 1e9);
+        text_printf(&t, "httpserver_stage_seconds_count{stage=\"%s\"} %lu\n", stage_names[s],
+            (unsigned long) below);
+    }
+
+    text_printf(&t, "# HELP httpserver_responses_total Responses sent, by status code.\n");
+    text_printf(&t, "# TYPE httpserver_responses_total counter\n");
+
+    for (int c = 0; c < NUM_CODES; c++) {
+        uint64_t count = 0;
+        for (struct local *l = atomic_load(&(m->locals)); l != NULL; l = l->next) {
+            count += atomic_load_explicit(&(l->codes[c]), memory_order_relaxed);
+        }
+        if (count > 0) {
+            text_printf(&t, "httpserver_responses_total{code=\"%d\"} %lu\n", c + MIN_CODE, (unsigned long) count);
+        }
+    }
+
+    *len = t.len;
+    return t.data;
+}
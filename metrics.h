@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct metrics metrics_t;
+
+typedef enum {
+    STAGE_ACCEPT,
+    STAGE_QUEUE,
+    STAGE_PARSE,
+    STAGE_LOCK,
+    STAGE_IO,
+    STAGE_SEND,
+    STAGE_TOTAL,
+    NUM_STAGES
+} STAGE;
+
+/** @brief Dynamically allocates and initializes a new set of per-stage
+ *         latency histograms and status code counters.  Every thread
+ *         records into its own copy, so recording never blocks.
+ *
+ *  @return a pointer to a new metrics_t
+ */
+metrics_t *metrics_new(void);
+
+/** @brief Delete your metrics and free all of their memory.  No thread
+ *         may still be recording.
+ *
+ *  @param m the metrics to be deleted.
+ */
+void metrics_delete(metrics_t **m);
+
+/** @brief record that one request spent ns nanoseconds in stage.
+ *
+ */
+void metrics_record(metrics_t *m, STAGE stage, uint64_t ns);
+
+/** @brief count one response with status code.
+ *
+ */
+void metrics_status(metrics_t *m, uint16_t code);
+
+/** @brief sum every thread's histogram for stage.
+ *
+ *  @param count set to the number of samples.
+ *
+ *  @param sum_ns set to the total time of all samples.
+ *
+ *  @return the q quantile (0 to 1) in nanoseconds, accurate to about 6%.
+ */
+uint64_t metrics_quantile(metrics_t *m, STAGE stage, double q, uint64_t *count, uint64_t *sum_ns);
+
+/** @brief render every stage histogram and status code counter in the
+ *         Prometheus text exposition format, reading the per-thread
+ *         copies without stopping the threads recording into them.
+ *
+ *  @param len set to the length of the text.
+ *
+ *  @return the text, which the caller frees.
+ */
+char *metrics_format(metrics_t *m, size_t *len);
@@ -0,0 +1,198 @@
+#include "parser.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// limits of TYPE_REGEX, URI_REGEX, HEADER_FIELD_REGEX and HEADER_VALUE_REGEX
+#define METHOD_MAX 8
+#define URI_MAX    (MAX_URI_LEN - 1)
+#define FIELD_MAX  128
+#define VALUE_MAX  128
+
+// character classes, [a-zA-Z], [a-zA-Z0-9.-] and [ -~]
+#define CLASS_ALPHA 1
+#define CLASS_TOKEN 2
+#define CLASS_VCHAR 4
+
+static uint8_t classes[256];
+
+__attribute__((constructor)) static void classes_init(void) {
+    for (int c = 0; c < 256; c++) {
+        bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        bool token = alpha || (c >= '0' && c <= '9') || c == '.' || c == '-';
+        classes[c] = (alpha ? CLASS_ALPHA : 0) | (token ? CLASS_TOKEN : 0) | (c >= ' ' && c <= '~' ? CLASS_VCHAR : 0);
+    }
+}
+
+static size_t span_scalar(const char *p, size_t i, size_t n, uint8_t cls) {
+    while (i < n && (classes[(unsigned char) p[i]] & cls)) {
+        i++;
+    }
+    return i;
+}
+
+// number of leading bytes of p, at most n, in [a-zA-Z0-9.-]
+static size_t span_token(const char *p, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // bytes of 0x80 and up are negative, so the signed compares reject them too
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i a = _mm_set1_epi8('a' - 1);
+    const __m128i z = _mm_set1_epi8('z' + 1);
+    const __m128i zero = _mm_set1_epi8('0' - 1);
+    const __m128i nine = _mm_set1_epi8('9' + 1);
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i dash = _mm_set1_epi8('-');
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i l = _mm_or_si128(v, lower);
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(l, a), _mm_cmplt_epi8(l, z));
+        ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(v, zero), _mm_cmplt_epi8(v, nine)));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, dot), _mm_cmpeq_epi8(v, dash)));
+
+        unsigned bad = ~(unsigned) _mm_movemask_epi8(ok) & 0xffff;
+        if (bad != 0) {
+            return i + (size_t) __builtin_ctz(bad);
+        }
+    }
+#endif
+    return span_scalar(p, i, n, CLASS_TOKEN);
+}
+
+// number of leading bytes of p, at most n, in [ -~]
+static size_t span_vchar(const char *p, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i lo = _mm_set1_epi8(' ' - 1);
+    const __m128i hi = _mm_set1_epi8('~' + 1);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+
+        unsigned bad = ~(unsigned) _mm_movemask_epi8(ok) & 0xffff;
+        if (bad != 0) {
+            return i + (size_t) __builtin_ctz(bad);
+        }
+    }
+#endif
+    return span_scalar(p, i, n, CLASS_VCHAR);
+}
+
+static size_t min_size(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+ssize_t parser_parse(const char *buf, size_t len, parser_request_t *req) {
+    // running out of bytes is only an error once a whole head's worth has arrived
+    size_t n = min_size(len, MAX_HEADER_LEN);
+    ssize_t more = len >= MAX_HEADER_LEN ? -1 : 0;
+    size_t i = 0;
+    size_t k;
+
+    // method, a space
+    k = span_scalar(buf, 0, min_size(n, METHOD_MAX + 1), CLASS_ALPHA);
+    if (k == n) {
+        return more;
+    }
+    if (k == 0 || k > METHOD_MAX || buf[k] != ' ') {
+        return -1;
+    }
+    req->method = 0;
+    req->method_len = (uint8_t) k;
+    i = k + 1;
+
+    // '/' and the uri, a space
+    if (i == n) {
+        return more;
+    }
+    if (buf[i] != '/') {
+        return -1;
+    }
+    i++;
+    k = span_token(buf + i, min_size(n - i, URI_MAX + 1));
+    if (i + k == n) {
+        return more;
+    }
+    if (k == 0 || k > URI_MAX || buf[i + k] != ' ') {
+        return -1;
+    }
+    req->uri = (uint16_t) i;
+    req->uri_len = (uint8_t) k;
+    i += k + 1;
+
+    // HTTP_REGEX's '.' is unescaped, so anything but NUL goes between the digits
+    if (i + 10 > n) {
+        return more;
+    }
+    if (memcmp(buf + i, "HTTP/", 5) != 0 || buf[i + 5] < '0' || buf[i + 5] > '9' || buf[i + 6] == '\0'
+        || buf[i + 7] < '0' || buf[i + 7] > '9' || buf[i + 8] != '\r' || buf[i + 9] != '\n') {
+        return -1;
+    }
+    req->version = (uint16_t) i;
+    i += 10;
+
+    // "name: value" lines up to the empty one
+    req->num_fields = 0;
+    while (true) {
+        if (i + 2 > n) {
+            return more;
+        }
+        if (buf[i] == '\r' && buf[i + 1] == '\n') {
+            return (ssize_t) (i + 2);
+        }
+
+        k = span_token(buf + i, min_size(n - i, FIELD_MAX + 1));
+        if (i + k == n) {
+            return more;
+        }
+        if (k == 0 || k > FIELD_MAX || buf[i + k] != ':') {
+            return -1;
+        }
+        parser_field_t *f = &(req->fields[req->num_fields]);
+        f->name = (uint16_t) i;
+        f->name_len = (uint8_t) k;
+        i += k + 1;
+
+        if (i == n) {
+            return more;
+        }
+        if (buf[i] != ' ') {
+            return -1;
+        }
+        i++;
+
+        k = span_vchar(buf + i, min_size(n - i, VALUE_MAX + 1));
+        if (i + k + 2 > n) {
+            return k > VALUE_MAX ? -1 : more;
+        }
+        if (k == 0 || k > VALUE_MAX || buf[i + k] != '\r' || buf[i + k + 1] != '\n') {
+            return -1;
+        }
+        f->value = (uint16_t) i;
+        f->value_len = (uint8_t) k;
+        i += k + 2;
+
+        // cannot overflow, every field takes at least 6 of the MAX_HEADER_LEN bytes
+        req->num_fields++;
+    }
+}
+
+const parser_field_t *parser_find(const parser_request_t *req, const char *buf, const char *name) {
+    size_t len = strlen(name);
+
+    for (uint16_t i = 0; i < req->num_fields; i++) {
+        const parser_field_t *f = &(req->fields[i]);
+        if (f->name_len == len && strncasecmp(buf + f->name, name, len) == 0) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// the shortest header line, "a: b\r\n", bounds how many fit in a head
+#define PARSER_MAX_FIELDS (MAX_HEADER_LEN / 6)
+
+// offsets and lengths into the buffer that was parsed
+typedef struct {
+    uint16_t name;
+    uint16_t value;
+    uint8_t name_len;
+    uint8_t value_len;
+} parser_field_t;
+
+typedef struct {
+    uint16_t method;
+    uint8_t method_len;
+
+    // without the leading '/', as conn_get_uri returns it
+    uint16_t uri;
+    uint8_t uri_len;
+
+    // the 8 bytes of "HTTP/x.y"
+    uint16_t version;
+
+    uint16_t num_fields;
+    parser_field_t fields[PARSER_MAX_FIELDS];
+} parser_request_t;
+
+/** @brief Parses a request line and its header fields in one pass over
+ *         buf, accepting exactly what the regular expressions in
+ *         protocol.h accept, with the same limits: 8 method letters, 63
+ *         URI characters, 128 characters per field name and value, and
+ *         MAX_HEADER_LEN bytes for the whole head.  Character classes are
+ *         checked 16 bytes at a time with SSE2 where it is available.
+ *
+ *  @param buf The bytes received so far.
+ *
+ *  @param len The number of bytes in buf.
+ *
+ *  @param req Filled in with where each part of the request is in buf.
+ *
+ *  @return The length of the head, up to and including the empty line,
+ *          0 if buf ends before the head does (i.e., read more), or, -1,
+ *          if the head is malformed or longer than MAX_HEADER_LEN.
+ */
+ssize_t parser_parse(const char *buf, size_t len, parser_request_t *req);
+
+/** @brief Looks up a header field by name, ignoring case.
+ *
+ *  @param req A request filled in by parser_parse.
+ *
+ *  @param buf The buffer req was parsed from.
+ *
+ *  @param name The field name.
+ *
+ *  @return The first field with that name, or NULL if there is none.
+ */
+const parser_field_t *parser_find(const parser_request_t *req, const char *buf, const char *name);
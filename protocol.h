@@ -13,3 +13,9 @@
 #define HEADER_VALUE_REGEX "[ -~]{1,128}"
 
 #define MAX_HEADER_LEN 2048
+
+/**
+ *  Buffer size for a URI matched by URI_REGEX, without the leading '/'.
+ */
+
+#define MAX_URI_LEN 64
@@ -3,80 +3,280 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
-#include <semaphore.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
+#define CACHE_LINE 64
+
+// one ring slot, seq tells producers and consumers whose turn it is, the
+// element is stored inline right after it
+struct cell {
+    atomic_size_t seq;
+    _Alignas(max_align_t) unsigned char elem[];
+};
+
+// bounded MPMC ring after Vyukov: producers and consumers claim positions with
+// a CAS on in/out and hand cells over through each cell's sequence number
 struct queue {
-    void **buf;
-    int n, in, out;
+    unsigned char *buf;
+    size_t n;
+    size_t elem_size;
+    size_t stride;
+
+    _Alignas(CACHE_LINE) atomic_size_t in;
+    _Alignas(CACHE_LINE) atomic_size_t out;
 
-    sem_t mutex;
-    sem_t empty_sem;
-    sem_t full_sem;
+    // threads only sleep when the ring is empty (consumers) or full (producers),
+    // the epochs are the futex words they sleep on
+    _Alignas(CACHE_LINE) atomic_uint not_empty;
+    atomic_int waiting_pop;
+    _Alignas(CACHE_LINE) atomic_uint not_full;
+    atomic_int waiting_push;
 };
 typedef struct queue queue_t;
 
-queue_t *queue_new(int size) {
-    if (size == 0) {
+static void futex_wait(atomic_uint *addr, unsigned int val) {
+    syscall(SYS_futex, (unsigned int *) addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wait_for(atomic_uint *addr, unsigned int val, const struct timespec *timeout) {
+    syscall(SYS_futex, (unsigned int *) addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int count) {
+    syscall(SYS_futex, (unsigned int *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static struct cell *cell_at(queue_t *q, size_t pos) {
+    return (struct cell *) (q->buf + (pos % q->n) * q->stride);
+}
+
+static bool try_push(queue_t *q, const void *elem) {
+    size_t pos = atomic_load_explicit(&(q->in), memory_order_relaxed);
+
+    while (1) {
+        struct cell *c = cell_at(q, pos);
+        size_t seq = atomic_load_explicit(&(c->seq), memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) pos;
+
+        if (diff == 0) {
+            // the cell is free for position pos, claim it
+            if (atomic_compare_exchange_weak_explicit(&(q->in), &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(c->elem, elem, q->elem_size);
+                atomic_store_explicit(&(c->seq), pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the consumer of the previous lap has not freed the cell, so we are full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&(q->in), memory_order_relaxed);
+        }
+    }
+}
+
+static bool try_pop(queue_t *q, void *elem) {
+    size_t pos = atomic_load_explicit(&(q->out), memory_order_relaxed);
+
+    while (1) {
+        struct cell *c = cell_at(q, pos);
+        size_t seq = atomic_load_explicit(&(c->seq), memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) seq - (ptrdiff_t) (pos + 1);
+
+        if (diff == 0) {
+            // the cell holds the element for position pos, claim it
+            if (atomic_compare_exchange_weak_explicit(&(q->out), &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(elem, c->elem, q->elem_size);
+                atomic_store_explicit(&(c->seq), pos + q->n, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // nothing has been pushed at position pos yet, so we are empty
+            return false;
+        } else {
+            pos = atomic_load_explicit(&(q->out), memory_order_relaxed);
+        }
+    }
+}
+
+queue_t *queue_new(int size, size_t elem_size) {
+    if (size <= 0) {
         return NULL;
     }
 
-    queue_t *q = (queue_t *) malloc(sizeof(queue_t));
+    // with one cell a freed cell's sequence number equals the next push position,
+    // so a second producer could claim it before the first element is popped
+    if (size < 2) {
+        size = 2;
+    }
 
-    q->buf = (void **) malloc(size * sizeof(void *));
+    queue_t *q = (queue_t *) aligned_alloc(CACHE_LINE, sizeof(queue_t));
 
+    // keep every cell aligned for its sequence number and element
+    size_t align = _Alignof(struct cell);
+    q->stride = (sizeof(struct cell) + elem_size + align - 1) / align * align;
+    q->buf = (unsigned char *) malloc(size * q->stride);
     q->n = size;
-    q->in = 0;
-    q->out = 0;
+    q->elem_size = elem_size;
 
-    sem_init(&(q->mutex), 0, 1);
-    sem_init(&(q->empty_sem), 0, 0);
-    sem_init(&(q->full_sem), 0, size);
+    for (int i = 0; i < size; i++) {
+        atomic_init(&(cell_at(q, i)->seq), (size_t) i);
+    }
+
+    atomic_init(&(q->in), 0);
+    atomic_init(&(q->out), 0);
+    atomic_init(&(q->not_empty), 0);
+    atomic_init(&(q->not_full), 0);
+    atomic_init(&(q->waiting_pop), 0);
+    atomic_init(&(q->waiting_push), 0);
 
     return q;
 }
 
 void queue_delete(queue_t **q) {
-    sem_destroy(&((*q)->mutex));
-    sem_destroy(&((*q)->empty_sem));
-    sem_destroy(&((*q)->full_sem));
-    free(*(*q)->buf);
+    free((*q)->buf);
     free(*q);
-    q = NULL;
+    *q = NULL;
+}
+
+static void wake_pop(queue_t *q) {
+    // order the publish in try_push before reading the sleeper count, pairs
+    // with the fetch_add a consumer does before its last look
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // only pay for a wakeup when a consumer is actually asleep
+    if (atomic_load(&(q->waiting_pop)) > 0) {
+        atomic_fetch_add(&(q->not_empty), 1);
+        futex_wake(&(q->not_empty), 1);
+    }
+}
+
+static void wake_push(queue_t *q) {
+    // order the release in try_pop before reading the sleeper count, pairs
+    // with the fetch_add a producer does before its last look
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // only pay for a wakeup when a producer is actually asleep
+    if (atomic_load(&(q->waiting_push)) > 0) {
+        atomic_fetch_add(&(q->not_full), 1);
+        futex_wake(&(q->not_full), 1);
+    }
 }
 
-bool queue_push(queue_t *q, void *elem) {
+bool queue_push(queue_t *q, const void *elem) {
     if (q == NULL) {
         return false;
     }
 
-    sem_wait(&(q->full_sem));
-    sem_wait(&(q->mutex));
+    while (!try_push(q, elem)) {
+        // announce ourselves before the last look so a pop cannot miss us
+        atomic_fetch_add(&(q->waiting_push), 1);
+        unsigned int epoch = atomic_load(&(q->not_full));
+        if (!try_push(q, elem)) {
+            futex_wait(&(q->not_full), epoch);
+            atomic_fetch_sub(&(q->waiting_push), 1);
+            continue;
+        }
+        atomic_fetch_sub(&(q->waiting_push), 1);
+        break;
+    }
 
-    (q->buf)[q->in] = elem;
-    q->in = ((q->in) + 1) % (q->n);
+    wake_pop(q);
 
-    sem_post((&q->mutex));
-    sem_post(&(q->empty_sem));
+    return true;
+}
+
+bool queue_pop(queue_t *q, void *elem) {
+    if (q == NULL) {
+        return false;
+    }
+
+    while (!try_pop(q, elem)) {
+        // announce ourselves before the last look so a push cannot miss us
+        atomic_fetch_add(&(q->waiting_pop), 1);
+        unsigned int epoch = atomic_load(&(q->not_empty));
+        if (!try_pop(q, elem)) {
+            futex_wait(&(q->not_empty), epoch);
+            atomic_fetch_sub(&(q->waiting_pop), 1);
+            continue;
+        }
+        atomic_fetch_sub(&(q->waiting_pop), 1);
+        break;
+    }
+
+    wake_push(q);
 
     return true;
 }
 
-bool queue_pop(queue_t *q, void **elem) {
+bool queue_pop_timed(queue_t *q, void *elem, int timeout_ms) {
     if (q == NULL) {
         return false;
     }
 
-    sem_wait(&(q->empty_sem));
-    sem_wait(&(q->mutex));
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (!try_pop(q, elem)) {
+        // the futex timeout is relative, so recompute what is left of the wait
+        struct timespec now, left;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = deadline.tv_sec - now.tv_sec;
+        left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec -= 1;
+            left.tv_nsec += 1000000000;
+        }
+        if (left.tv_sec < 0) {
+            return false;
+        }
+
+        atomic_fetch_add(&(q->waiting_pop), 1);
+        unsigned int epoch = atomic_load(&(q->not_empty));
+        if (!try_pop(q, elem)) {
+            futex_wait_for(&(q->not_empty), epoch, &left);
+            atomic_fetch_sub(&(q->waiting_pop), 1);
+            continue;
+        }
+        atomic_fetch_sub(&(q->waiting_pop), 1);
+        break;
+    }
+
+    wake_push(q);
+
+    return true;
+}
+
+bool queue_try_push(queue_t *q, const void *elem) {
+    if (q == NULL || !try_push(q, elem)) {
+        return false;
+    }
+
+    wake_pop(q);
 
-    *elem = (q->buf)[q->out];
-    (q->buf)[q->out] = NULL;
-    q->out = ((q->out) + 1) % (q->n);
+    return true;
+}
+
+bool queue_try_pop(queue_t *q, void *elem) {
+    if (q == NULL || !try_pop(q, elem)) {
+        return false;
+    }
 
-    sem_post(&(q->mutex));
-    sem_post(&(q->full_sem));
+    wake_push(q);
 
     return true;
 }
@@ -7,13 +7,16 @@
 typedef struct queue queue_t;
 
 /** @brief Dynamically allocates and initializes a new queue with a
- *         maximum size, size
+ *         maximum size, size, whose elements are elem_size bytes that
+ *         are copied in and out by value.
  *
- *  @param size the maximum size of the queue
+ *  @param size the maximum size of the queue, raised to 2 if smaller
+ *
+ *  @param elem_size the size of one element in bytes
  *
  *  @return a pointer to a new queue_t
  */
-queue_t *queue_new(int size);
+queue_t *queue_new(int size, size_t elem_size);
 
 /** @brief Delete your queue and free all of its memory.
  *
@@ -25,18 +28,37 @@ void queue_delete(queue_t **q);
  *
  *  @param q the queue to push an element into.
  *
- *  @param elem th element to add to the queue
+ *  @param elem points to the element to copy into the queue
  *
  *  @return A bool indicating success or failure.
  */
-bool queue_push(queue_t *q, void *elem);
+bool queue_push(queue_t *q, const void *elem);
 
 /** @brief pop an element from a queue.
  *
  *  @param q the queue to pop an element from.
  *
- *  @param elem a place to assign the poped element.
+ *  @param elem a place to copy the poped element into.
  *
  *  @return A bool indicating success or failure.
  */
-bool queue_pop(queue_t *q, void **elem);
+bool queue_pop(queue_t *q, void *elem);
+
+/** @brief pop an element from a queue, waiting at most timeout_ms
+ *         milliseconds for one to arrive.
+ *
+ *  @return A bool indicating success, or failure if the wait timed out.
+ */
+bool queue_pop_timed(queue_t *q, void *elem, int timeout_ms);
+
+/** @brief push an element onto a queue without blocking.
+ *
+ *  @return A bool indicating success, or failure if the queue is full.
+ */
+bool queue_try_push(queue_t *q, const void *elem);
+
+/** @brief pop an element from a queue without blocking.
+ *
+ *  @return A bool indicating success, or failure if the queue is empty.
+ */
+bool queue_try_pop(queue_t *q, void *elem);
@@ -0,0 +1,106 @@
+#include "range.h"
+
+#include <stdbool.h>
+#include <strings.h>
+
+// reads a run of digits, false if there is none or it overflows
+static bool parse_num(const char **p, uint64_t *out) {
+    const char *s = *p;
+    uint64_t n = 0;
+
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    while (*s >= '0' && *s <= '9') {
+        uint64_t d = (uint64_t) (*s - '0');
+        if (n > (UINT64_MAX - d) / 10) {
+            return false;
+        }
+        n = n * 10 + d;
+        s++;
+    }
+
+    *p = s;
+    *out = n;
+    return true;
+}
+
+static void skip_ws(const char **p) {
+    while (**p == ' ' || **p == '\t') {
+        (*p)++;
+    }
+}
+
+int range_parse(const char *value, uint64_t size, range_t *ranges, int max) {
+    if (strncasecmp(value, "bytes=", 6) != 0) {
+        return -1;
+    }
+
+    const char *p = value + 6;
+    int specs = 0;
+    int count = 0;
+
+    while (true) {
+        skip_ws(&p);
+
+        // empty list elements are allowed, as in "bytes=0-1,,5-6"
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        if (++specs > max) {
+            return -1;
+        }
+
+        uint64_t first, last;
+        if (*p == '-') {
+            // suffix range, the last n bytes
+            p++;
+            if (!parse_num(&p, &last)) {
+                return -1;
+            }
+            if (last > 0 && size > 0) {
+                uint64_t n = last < size ? last : size;
+                ranges[count].offset = size - n;
+                ranges[count].length = n;
+                count++;
+            }
+        } else {
+            if (!parse_num(&p, &first) || *p != '-') {
+                return -1;
+            }
+            p++;
+
+            // an open range runs to the end
+            last = UINT64_MAX;
+            if (*p >= '0' && *p <= '9' && !parse_num(&p, &last)) {
+                return -1;
+            }
+            if (last < first) {
+                return -1;
+            }
+            if (first < size) {
+                if (last >= size) {
+                    last = size - 1;
+                }
+                ranges[count].offset = first;
+                ranges[count].length = last - first + 1;
+                count++;
+            }
+        }
+
+        skip_ws(&p);
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+
+    // "bytes=" alone is not a range set
+    return specs == 0 ? -1 : count;
+}
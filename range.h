@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// most ranges one request may ask for, a longer list is ignored
+#define MAX_RANGES 16
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} range_t;
+
+/** @brief Parses the value of a Range header (e.g., "bytes=0-99,-500")
+ *         against a representation of size bytes.  Ranges that start
+ *         past the end are dropped and the rest are clipped to size.
+ *
+ *  @param value The header value.
+ *
+ *  @param size The size of the file.
+ *
+ *  @param ranges Filled in with the satisfiable ranges, in request order.
+ *
+ *  @param max The capacity of ranges.
+ *
+ *  @return The number of satisfiable ranges, 0 if there are none (i.e.,
+ *          416), or, -1 if the header is malformed, not in bytes, or asks
+ *          for more than max ranges, in which case it should be ignored.
+ */
+int range_parse(const char *value, uint64_t size, range_t *ranges, int max);
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include "reactor.h"
+#include "protocol.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define REACTOR_EVENTS   64
+#define REACTOR_SWEEP_MS 100
+
+// how often parked connections are offered to ready again
+#define REACTOR_RETRY_MS 1
+
+struct reactor {
+    reactor_ready_fn ready;
+    int idle_ms;
+    int epfd;
+
+    // deadline (monotonic ms) per watched fd, 0 when the fd belongs to a worker
+    atomic_llong *deadline;
+
+    // requests served per watched fd, carried from one worker to the next
+    atomic_int *served;
+    int max_fds;
+    atomic_int high_fd;
+
+    // fds with a full header that ready turned away, in arrival order, only the
+    // event thread touches these
+    bool *parked;
+    int *park;
+    int num_parked;
+
+    atomic_bool stop;
+    pthread_t thread;
+};
+typedef struct reactor reactor_t;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void release_fd(reactor_t *r, int fd) {
+    atomic_store(&(r->deadline[fd]), 0);
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void close_fd(reactor_t *r, int fd) {
+    release_fd(r, fd);
+    r->parked[fd] = false;
+    close(fd);
+}
+
+// the fd leaves the reactor before ready sees it, since the new owner may hand
+// it straight back with reactor_add, if ready turns it away it keeps its deadline
+static bool hand_off(reactor_t *r, int fd) {
+    long long deadline = atomic_load(&(r->deadline[fd]));
+    release_fd(r, fd);
+
+    if (r->ready(fd, atomic_load(&(r->served[fd])))) {
+        return true;
+    }
+
+    atomic_store(&(r->deadline[fd]), deadline);
+    return false;
+}
+
+// a connection that ready turned away waits here, out of epoll, so the event
+// thread never blocks on a full queue and the sweep still closes it in time
+static void park_fd(reactor_t *r, int fd) {
+    if (r->num_parked == r->max_fds) {
+        close_fd(r, fd);
+        return;
+    }
+    r->parked[fd] = true;
+    r->park[r->num_parked++] = fd;
+}
+
+static void retry_parked(reactor_t *r) {
+    int kept = 0;
+    bool full = false;
+
+    // fds closed by the sweep meanwhile were unparked, the rest keep their order
+    for (int i = 0; i < r->num_parked; i++) {
+        int fd = r->park[i];
+        if (!r->parked[fd]) {
+            continue;
+        }
+        if (!full && hand_off(r, fd)) {
+            r->parked[fd] = false;
+            continue;
+        }
+        full = true;
+        r->park[kept++] = fd;
+    }
+
+    r->num_parked = kept;
+}
+
+static void arm_fd(reactor_t *r, int fd, int op) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(r->epfd, op, fd, &ev) < 0) {
+        close_fd(r, fd);
+    }
+}
+
+static void on_readable(reactor_t *r, int fd, uint32_t events) {
+    if (atomic_load(&(r->deadline[fd])) == 0 || r->parked[fd]) {
+        return;
+    }
+
+    // look at what has arrived without consuming it, conn_parse reads it later
+    char buf[MAX_HEADER_LEN];
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_fd(r, fd);
+        return;
+    }
+    if (n < 0) {
+        arm_fd(r, fd, EPOLL_CTL_MOD);
+        return;
+    }
+
+    // a full header (or more than a header can hold, which conn_parse rejects)
+    // is ready, so a worker can parse it without blocking
+    if (n == MAX_HEADER_LEN || memmem(buf, n, "\r\n\r\n", 4) != NULL) {
+        int lowat = 1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+        if (!hand_off(r, fd)) {
+            park_fd(r, fd);
+        }
+        return;
+    }
+
+    // the peer is done sending, so the header can never complete, and at EOF the
+    // socket stays readable whatever the low-water mark
+    if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        close_fd(r, fd);
+        return;
+    }
+
+    // partial header: only wake up again once more bytes than we have seen arrive
+    int lowat = (int) n + 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+    arm_fd(r, fd, EPOLL_CTL_MOD);
+}
+
+static void sweep(reactor_t *r) {
+    long long now = now_ms();
+    int high = atomic_load(&(r->high_fd));
+
+    // close connections that went idle or never finished their header
+    for (int fd = 0; fd <= high; fd++) {
+        long long d = atomic_load(&(r->deadline[fd]));
+        if (d != 0 && d <= now) {
+            close_fd(r, fd);
+        }
+    }
+}
+
+static void *reactor_exec(void *arg) {
+    reactor_t *r = (reactor_t *) arg;
+    struct epoll_event events[REACTOR_EVENTS];
+    long long last_sweep = now_ms();
+
+    while (!atomic_load(&(r->stop))) {
+        int n = epoll_wait(r->epfd, events, REACTOR_EVENTS, r->num_parked > 0 ? REACTOR_RETRY_MS : REACTOR_SWEEP_MS);
+
+        // connections parked earlier go first, so they keep their place in line
+        if (r->num_parked > 0) {
+            retry_parked(r);
+        }
+        for (int i = 0; i < n; i++) {
+            on_readable(r, events[i].data.fd, events[i].events);
+        }
+
+        if (now_ms() - last_sweep >= REACTOR_SWEEP_MS) {
+            sweep(r);
+            last_sweep = now_ms();
+        }
+    }
+
+    return NULL;
+}
+
+reactor_t *reactor_new(reactor_ready_fn ready, int idle_ms) {
+    if (ready == NULL) {
+        return NULL;
+    }
+
+    reactor_t *r = (reactor_t *) malloc(sizeof(reactor_t));
+
+    r->ready = ready;
+    r->idle_ms = idle_ms;
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    struct rlimit rl;
+    r->max_fds = 1 << 16;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+        && rl.rlim_cur < (rlim_t) (1 << 20)) {
+        r->max_fds = (int) rl.rlim_cur;
+    }
+    r->deadline = (atomic_llong *) calloc(r->max_fds, sizeof(atomic_llong));
+    r->served = (atomic_int *) calloc(r->max_fds, sizeof(atomic_int));
+    r->parked = (bool *) calloc(r->max_fds, sizeof(bool));
+    r->park = (int *) calloc(r->max_fds, sizeof(int));
+    r->num_parked = 0;
+    atomic_init(&(r->high_fd), 0);
+    atomic_init(&(r->stop), false);
+
+    if (r->epfd < 0 || r->deadline == NULL || r->served == NULL || r->parked == NULL || r->park == NULL
+        || pthread_create(&(r->thread), NULL, reactor_exec, r) != 0) {
+        if (r->epfd >= 0) {
+            close(r->epfd);
+        }
+        free(r->deadline);
+        free(r->served);
+        free(r->parked);
+        free(r->park);
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void reactor_delete(reactor_t **r) {
+    atomic_store(&((*r)->stop), true);
+    pthread_join((*r)->thread, NULL);
+
+    int high = atomic_load(&((*r)->high_fd));
+    for (int fd = 0; fd <= high; fd++) {
+        if (atomic_load(&((*r)->deadline[fd])) != 0) {
+            close(fd);
+        }
+    }
+
+    close((*r)->epfd);
+    free((*r)->deadline);
+    free((*r)->served);
+    free((*r)->parked);
+    free((*r)->park);
+    free(*r);
+    *r = NULL;
+}
+
+bool reactor_add(reactor_t *r, int fd, int served) {
+    if (r == NULL || fd < 0 || fd >= r->max_fds) {
+        return false;
+    }
+
+    int high = atomic_load(&(r->high_fd));
+    while (fd > high && !atomic_compare_exchange_weak(&(r->high_fd), &high, fd)) {
+    }
+
+    atomic_store(&(r->served[fd]), served);
+    atomic_store(&(r->deadline[fd]), now_ms() + r->idle_ms);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        atomic_store(&(r->deadline[fd]), 0);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct reactor reactor_t;
+
+/** @brief Called on the event thread with a connection that has a full
+ *         request header ready, along with the number of requests
+ *         already served on it that reactor_add was given.  Must not
+ *         block.
+ *
+ *  @return true if the callee took fd and owns it from then on, false
+ *          to leave it with the reactor, which offers it again shortly
+ *          and closes it once its deadline passes.
+ */
+typedef bool (*reactor_ready_fn)(int fd, int served);
+
+/** @brief Dynamically allocates and initializes a new reactor and
+ *         starts its event thread.  The reactor owns idle connections
+ *         and hands a connection to ready once a full request header
+ *         has arrived on it.
+ *
+ *  @param ready the function that ready connections are handed to.
+ *
+ *  @param idle_ms milliseconds a watched connection may take to deliver
+ *         a full request header before the reactor closes it.
+ *
+ *  @return a pointer to a new reactor_t, or NULL on failure.
+ */
+reactor_t *reactor_new(reactor_ready_fn ready, int idle_ms);
+
+/** @brief Stop the event thread, delete your reactor and free all of its
+ *         memory.  Connections still being watched are closed.
+ *
+ *  @param r the reactor to be deleted.
+ */
+void reactor_delete(reactor_t **r);
+
+/** @brief hand a connection to the reactor, which watches it until a
+ *         full request header is ready to be parsed without blocking.
+ *         Safe to call from any thread.
+ *
+ *  @param r the reactor to watch the connection.
+ *
+ *  @param fd the connected socket.
+ *
+ *  @param served the number of requests already served on fd, 0 for a
+ *         new connection, handed back to ready with it.
+ *
+ *  @return A bool indicating success or failure.  On failure the caller
+ *          still owns fd.
+ */
+bool reactor_add(reactor_t *r, int fd, int served);
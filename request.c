@@ -0,0 +1,15 @@
+#include "request.h"
+
+struct Request {
+    const char *name;
+};
+
+const Request_t REQUEST_GET = { "GET" };
+const Request_t REQUEST_PUT = { "PUT" };
+const Request_t REQUEST_UNSUPPORTED = { "UNSUPPORTED" };
+
+const Request_t *requests[NUM_REQUESTS] = { &REQUEST_GET, &REQUEST_PUT, &REQUEST_UNSUPPORTED };
+
+const char *request_get_str(const Request_t *req) {
+    return req->name;
+}
@@ -6,9 +6,12 @@ typedef struct Response Response_t;
 
 extern const Response_t RESPONSE_OK;
 extern const Response_t RESPONSE_CREATED;
+extern const Response_t RESPONSE_PARTIAL_CONTENT;
+extern const Response_t RESPONSE_NOT_MODIFIED;
 extern const Response_t RESPONSE_BAD_REQUEST;
 extern const Response_t RESPONSE_FORBIDDEN;
 extern const Response_t RESPONSE_NOT_FOUND;
+extern const Response_t RESPONSE_RANGE_NOT_SATISFIABLE;
 extern const Response_t RESPONSE_INTERNAL_SERVER_ERROR;
 extern const Response_t RESPONSE_NOT_IMPLEMENTED;
 extern const Response_t RESPONSE_VERSION_NOT_SUPPORTED;
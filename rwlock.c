@@ -3,154 +3,322 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
-#include <semaphore.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// the lock word: active readers in the low 32 bits, then the writer and
+// pending bits, and the reads since the last writer in the bits above them
+#define READER  ((uint64_t) 1)
+#define READERS_MASK ((uint64_t) 0xffffffff)
+#define WRITER  ((uint64_t) 1 << 32)
+#define PENDING ((uint64_t) 1 << 33)
+#define TOTAL   ((uint64_t) 1 << 34)
+
+#define ACTIVE_R(s) ((s) & READERS_MASK)
+#define TOTAL_R(s)  ((s) >> 34)
+
+// profile counters, only updated while profiling is on
+struct profile {
+    atomic_ulong reads;
+    atomic_ulong writes;
+    atomic_ulong read_waits;
+    atomic_ulong write_waits;
+    atomic_ulong read_wait_ns;
+    atomic_ulong write_wait_ns;
+    atomic_ulong read_hold_ns;
+    atomic_ulong write_hold_ns;
+    atomic_ulong max_wait_ns;
+};
 
 struct rwlock {
     PRIORITY p;
-    int n;
+    uint64_t n;
 
-    pthread_mutex_t lock;
-    pthread_cond_t readCV;
-    pthread_cond_t writeCV;
+    // while nobody waits, readers and writers only touch state, with one atomic op each
+    _Atomic uint64_t state;
 
-    int activeR;
-    int activeW;
+    // the slow path, entered once someone has to wait, PENDING is set exactly
+    // while waitingR or waitingW is non-zero
+    pthread_mutex_t lock;
+    atomic_uint readEpoch;
+    atomic_uint writeEpoch;
     int waitingR;
     int waitingW;
 
-    int totalR;
+    struct profile prof;
+    uint64_t write_since;
 };
 
 typedef struct rwlock rwlock_t;
 
+static atomic_bool profiling = false;
+
+// the read lock this thread holds and since when, for read hold times
+static __thread rwlock_t *read_held = NULL;
+static __thread uint64_t read_since = 0;
+
+static void futex_wait(atomic_uint *addr, unsigned int val) {
+    syscall(SYS_futex, (unsigned int *) addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int count) {
+    syscall(SYS_futex, (unsigned int *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// sleep on epoch until someone bumps it, called and returns with rw->lock held
+static void slow_wait(rwlock_t *rw, atomic_uint *epoch) {
+    unsigned int seen = atomic_load(epoch);
+    pthread_mutex_unlock(&(rw->lock));
+    futex_wait(epoch, seen);
+    pthread_mutex_lock(&(rw->lock));
+}
+
+// called with rw->lock held
+static void slow_wake(atomic_uint *epoch, int count) {
+    atomic_fetch_add(epoch, 1);
+    futex_wake(epoch, count);
+}
+
+// called with rw->lock held, keeps PENDING in step with the wait counts
+static void slow_update_pending(rwlock_t *rw) {
+    if (rw->waitingR > 0 || rw->waitingW > 0) {
+        atomic_fetch_or(&(rw->state), PENDING);
+    } else {
+        atomic_fetch_and(&(rw->state), ~PENDING);
+    }
+}
+
+static uint64_t prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// the time an acquisition started, or 0 when not profiling
+static uint64_t prof_start(void) {
+    return atomic_load_explicit(&profiling, memory_order_relaxed) ? prof_now() : 0;
+}
+
+static void prof_acquired(rwlock_t *rw, bool write, uint64_t start, bool contended) {
+    if (start == 0) {
+        return;
+    }
+
+    uint64_t now = prof_now();
+    uint64_t wait = now - start;
+    struct profile *p = &(rw->prof);
+
+    atomic_fetch_add_explicit(write ? &(p->writes) : &(p->reads), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(write ? &(p->write_wait_ns) : &(p->read_wait_ns), wait, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(write ? &(p->write_waits) : &(p->read_waits), 1, memory_order_relaxed);
+    }
+
+    unsigned long max = atomic_load_explicit(&(p->max_wait_ns), memory_order_relaxed);
+    while (wait > max && !atomic_compare_exchange_weak(&(p->max_wait_ns), &max, wait)) {
+    }
+
+    if (write) {
+        rw->write_since = now;
+    } else {
+        read_held = rw;
+        read_since = now;
+    }
+}
+
+static bool reader_may_enter(rwlock_t *rw, uint64_t s) {
+    if (s & WRITER) {
+        return false;
+    }
+    if (rw->p == WRITERS) {
+        return rw->waitingW == 0;
+    }
+    if (rw->p == N_WAY) {
+        return rw->waitingW == 0 || TOTAL_R(s) < rw->n;
+    }
+    return true;
+}
+
+static bool writer_may_enter(rwlock_t *rw, uint64_t s) {
+    if ((s & WRITER) || ACTIVE_R(s) > 0) {
+        return false;
+    }
+    if (rw->p == READERS) {
+        return rw->waitingR == 0;
+    }
+    if (rw->p == N_WAY) {
+        return !(TOTAL_R(s) < rw->n && rw->waitingR > 0);
+    }
+    return true;
+}
+
 rwlock_t *rwlock_new(PRIORITY p, uint32_t n) {
     rwlock_t *rwl = (rwlock_t *) malloc(sizeof(rwlock_t));
     rwl->p = p;
     rwl->n = n;
 
-    rwl->activeR = 0;
-    rwl->activeW = 0;
+    atomic_init(&(rwl->state), 0);
+    atomic_init(&(rwl->readEpoch), 0);
+    atomic_init(&(rwl->writeEpoch), 0);
     rwl->waitingR = 0;
     rwl->waitingW = 0;
-    rwl->totalR = 0;
 
-    pthread_cond_init(&(rwl->writeCV), NULL);
-    pthread_cond_init(&(rwl->readCV), NULL);
+    memset(&(rwl->prof), 0, sizeof(struct profile));
+    rwl->write_since = 0;
+
     pthread_mutex_init(&(rwl->lock), NULL);
 
     return rwl;
 }
 
 void rwlock_delete(rwlock_t **l) {
-    pthread_cond_destroy(&((*l)->writeCV));
-    pthread_cond_destroy(&((*l)->readCV));
     pthread_mutex_destroy(&((*l)->lock));
     free(*l);
-    l = NULL;
+    *l = NULL;
 }
 
 void reader_lock(rwlock_t *rw) {
+    uint64_t start = prof_start();
+
+    // fast path, nobody holds or waits for the lock for writing
+    uint64_t s = atomic_fetch_add_explicit(&(rw->state), READER | TOTAL, memory_order_acquire);
+    if (!(s & (WRITER | PENDING))) {
+        prof_acquired(rw, false, start, false);
+        return;
+    }
+
     pthread_mutex_lock(&(rw->lock));
 
-    rw->waitingR += 1;
-    while (rw->activeW > 0) {
-        pthread_cond_wait(&(rw->readCV), &(rw->lock));
+    // take back the optimistic increment, a writer may have been waiting on it
+    s = atomic_fetch_sub(&(rw->state), READER | TOTAL) - (READER | TOTAL);
+    if (ACTIVE_R(s) == 0 && rw->waitingW > 0) {
+        slow_wake(&(rw->writeEpoch), 1);
     }
-    if (rw->p == WRITERS) {
-        while ((rw->waitingW > 0) || (rw->activeW > 0)) {
-            pthread_cond_wait(&(rw->readCV), &(rw->lock));
-        }
-    } else if (rw->p == N_WAY) {
-        while ((rw->totalR >= rw->n) || (rw->activeW > 0)) {
-            pthread_cond_wait(&(rw->readCV), &(rw->lock));
-            if ((rw->waitingW == 0) && (rw->waitingR > 0)) {
-                break;
-            }
-        }
+
+    rw->waitingR += 1;
+    slow_update_pending(rw);
+
+    while (!reader_may_enter(rw, atomic_load(&(rw->state)))) {
+        slow_wait(rw, &(rw->readEpoch));
     }
+
+    // writers only enter under rw->lock, so nothing can take the lock from under us here
+    atomic_fetch_add(&(rw->state), READER | TOTAL);
     rw->waitingR -= 1;
-    rw->activeR += 1;
-    rw->totalR += 1;
+    slow_update_pending(rw);
 
     pthread_mutex_unlock(&(rw->lock));
+
+    prof_acquired(rw, false, start, true);
 }
 
 void reader_unlock(rwlock_t *rw) {
+    if (read_held == rw) {
+        atomic_fetch_add_explicit(&(rw->prof.read_hold_ns), prof_now() - read_since, memory_order_relaxed);
+        read_held = NULL;
+    }
+
+    uint64_t s = atomic_fetch_sub_explicit(&(rw->state), READER, memory_order_release);
+
+    // only the last reader out has anyone to wake, and only if someone waits
+    if (!(s & PENDING) || ACTIVE_R(s) != 1) {
+        return;
+    }
+
     pthread_mutex_lock(&(rw->lock));
-    rw->activeR -= 1;
+    if (rw->waitingW > 0) {
+        slow_wake(&(rw->writeEpoch), 1);
+    }
     pthread_mutex_unlock(&(rw->lock));
+}
 
-    if (rw->p == WRITERS) {
-        if (rw->activeW == 0 && rw->waitingW == 0) {
-            pthread_cond_signal(&(rw->readCV));
-        } else {
-            pthread_cond_signal(&(rw->writeCV));
-        }
-    } else if (rw->p == READERS) {
-        if (rw->waitingR > 0) {
-            pthread_cond_broadcast(&(rw->readCV));
-        } else if (rw->waitingR == 0 && rw->activeR == 0) {
-            pthread_cond_signal(&(rw->writeCV));
-        }
-    } else if (rw->p == N_WAY) {
-        if (rw->totalR < rw->n && rw->waitingR > 0) {
-            pthread_cond_broadcast(&(rw->readCV));
-        } else {
-            if (rw->waitingW > 0 && rw->activeR == 0) {
-                pthread_cond_signal(&(rw->writeCV));
-            } else if (rw->waitingW == 0 && rw->waitingR > 0) {
-                pthread_cond_broadcast(&(rw->readCV));
-            }
+void writer_lock(rwlock_t *rw) {
+    uint64_t start = prof_start();
+
+    // fast path, the lock is free and nobody waits for it
+    uint64_t s = atomic_load_explicit(&(rw->state), memory_order_relaxed);
+    while (ACTIVE_R(s) == 0 && !(s & (WRITER | PENDING))) {
+        if (atomic_compare_exchange_weak_explicit(&(rw->state), &s, WRITER,
+                memory_order_acquire, memory_order_relaxed)) {
+            prof_acquired(rw, true, start, false);
+            return;
         }
     }
-}
 
-void writer_lock(rwlock_t *rw) {
     pthread_mutex_lock(&(rw->lock));
 
     rw->waitingW += 1;
+    slow_update_pending(rw);
 
-    if (rw->p == READERS) {
-        while ((rw->activeR > 0) || (rw->waitingR > 0)) {
-            pthread_cond_wait(&(rw->writeCV), &(rw->lock));
-        }
-    } else if (rw->p == N_WAY) {
-        while (rw->totalR < rw->n || rw->activeR > 0) {
-            pthread_cond_wait(&(rw->writeCV), &(rw->lock));
-            if ((rw->activeR == 0) && (rw->waitingR == 0)) {
+    while (1) {
+        // a reader on its way through the fast path can still bump the count, so
+        // the claim is a CAS and a failed one means waiting for that reader's wakeup
+        s = atomic_load(&(rw->state));
+        if (writer_may_enter(rw, s)) {
+            // the writer resets the reads counted since the last writer
+            uint64_t claimed = (s & PENDING) | WRITER;
+            if (atomic_compare_exchange_strong(&(rw->state), &s, claimed)) {
                 break;
             }
+            continue;
         }
+        slow_wait(rw, &(rw->writeEpoch));
     }
 
-    while ((rw->activeW > 0) || (rw->activeR > 0)) {
-        pthread_cond_wait(&(rw->writeCV), &(rw->lock));
-    }
     rw->waitingW -= 1;
-    rw->activeW += 1;
-    rw->totalR = 0;
+    slow_update_pending(rw);
 
     pthread_mutex_unlock(&(rw->lock));
+
+    prof_acquired(rw, true, start, true);
 }
 
 void writer_unlock(rwlock_t *rw) {
+    // the hold ends before the lock is released, while write_since is still ours
+    if (rw->write_since != 0) {
+        atomic_fetch_add_explicit(&(rw->prof.write_hold_ns), prof_now() - rw->write_since, memory_order_relaxed);
+        rw->write_since = 0;
+    }
+
+    uint64_t s = atomic_fetch_and_explicit(&(rw->state), ~WRITER, memory_order_release);
+
+    if (!(s & PENDING)) {
+        return;
+    }
+
+    // the readers decide among themselves who may enter, one writer is enough
+    // since writers all wait for the same thing
     pthread_mutex_lock(&(rw->lock));
-    rw->activeW -= 1;
+    if (rw->waitingR > 0) {
+        slow_wake(&(rw->readEpoch), INT32_MAX);
+    }
+    if (rw->waitingW > 0) {
+        slow_wake(&(rw->writeEpoch), 1);
+    }
     pthread_mutex_unlock(&(rw->lock));
+}
 
-    if (rw->p == WRITERS) {
-        if (rw->waitingW > 0) {
-            pthread_cond_signal(&(rw->writeCV));
-        } else if (rw->waitingR > 0) {
-            pthread_cond_broadcast(&(rw->readCV));
-        }
-    } else {
-        if (rw->waitingR == 0) {
-            pthread_cond_signal(&(rw->writeCV));
-        } else {
-            pthread_cond_broadcast(&(rw->readCV));
-        }
-    }
+void rwlock_profile(bool enable) {
+    atomic_store(&profiling, enable);
+}
+
+void rwlock_stats(rwlock_t *rw, rwlock_stats_t *stats, bool reset) {
+    struct profile *p = &(rw->prof);
+
+#define TAKE(field) (reset ? atomic_exchange(&(p->field), 0) : atomic_load(&(p->field)))
+    stats->reads = TAKE(reads);
+    stats->writes = TAKE(writes);
+    stats->read_waits = TAKE(read_waits);
+    stats->write_waits = TAKE(write_waits);
+    stats->read_wait_ns = TAKE(read_wait_ns);
+    stats->write_wait_ns = TAKE(write_wait_ns);
+    stats->read_hold_ns = TAKE(read_hold_ns);
+    stats->write_hold_ns = TAKE(write_hold_ns);
+    stats->max_wait_ns = TAKE(max_wait_ns);
+#undef TAKE
 }
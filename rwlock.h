@@ -1,11 +1,27 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct rwlock rwlock_t;
 
 typedef enum { READERS, WRITERS, N_WAY } PRIORITY;
 
+/** Profile counters of one rwlock, times in nanoseconds.  A wait counts
+ *  as contended when the acquisition had to take the slow path.
+ */
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_waits;
+    uint64_t write_waits;
+    uint64_t read_wait_ns;
+    uint64_t write_wait_ns;
+    uint64_t read_hold_ns;
+    uint64_t write_hold_ns;
+    uint64_t max_wait_ns;
+} rwlock_stats_t;
+
 /** @brief Dynamically allocates and initializes a new rwlock with
  *         priority p, and, if using N_WAY priority, n.
  *
@@ -45,3 +61,16 @@ void writer_lock(rwlock_t *rw);
  *
  */
 void writer_unlock(rwlock_t *rw);
+
+/** @brief turn profiling on or off for every rwlock.  While it is off the
+ *         lock functions do not read the clock or touch the counters.
+ *         Read hold times are only tracked for one read lock per thread.
+ *
+ */
+void rwlock_profile(bool enable);
+
+/** @brief copy the profile counters of rw into stats, and zero them if
+ *         reset is set.
+ *
+ */
+void rwlock_stats(rwlock_t *rw, rwlock_stats_t *stats, bool reset);
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+
+#include "scheduler.h"
+#include "queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define CACHE_LINE 64
+
+struct scheduler {
+    queue_t **local;
+    int n;
+
+    _Alignas(CACHE_LINE) atomic_uint next;
+
+    // idle workers sleep on epoch until a push finds sleepers > 0
+    _Alignas(CACHE_LINE) atomic_uint epoch;
+    atomic_int sleepers;
+};
+typedef struct scheduler scheduler_t;
+
+// take from our own queue, then from each neighbor in turn
+static bool take(scheduler_t *s, int worker, void *elem) {
+    for (int i = 0; i < s->n; i++) {
+        if (queue_try_pop(s->local[(worker + i) % s->n], elem)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+scheduler_t *scheduler_new(int workers, int depth, size_t elem_size) {
+    if (workers <= 0 || depth <= 0) {
+        return NULL;
+    }
+
+    scheduler_t *s = (scheduler_t *) aligned_alloc(CACHE_LINE, sizeof(scheduler_t));
+
+    s->n = workers;
+    s->local = (queue_t **) malloc(workers * sizeof(queue_t *));
+    for (int i = 0; i < workers; i++) {
+        s->local[i] = queue_new(depth, elem_size);
+    }
+
+    atomic_init(&(s->next), 0);
+    atomic_init(&(s->epoch), 0);
+    atomic_init(&(s->sleepers), 0);
+
+    return s;
+}
+
+void scheduler_delete(scheduler_t **s) {
+    for (int i = 0; i < (*s)->n; i++) {
+        queue_delete(&((*s)->local[i]));
+    }
+    free((*s)->local);
+    free(*s);
+    *s = NULL;
+}
+
+static bool push(scheduler_t *s, const void *elem, bool block) {
+    if (s == NULL) {
+        return false;
+    }
+
+    unsigned int start = atomic_fetch_add_explicit(&(s->next), 1, memory_order_relaxed) % s->n;
+
+    bool pushed = false;
+    for (int i = 0; i < s->n && !pushed; i++) {
+        pushed = queue_try_push(s->local[(start + i) % s->n], elem);
+    }
+    if (!pushed) {
+        if (!block) {
+            return false;
+        }
+        queue_push(s->local[start], elem);
+    }
+
+    // any idle worker can steal it, so wake one if some are asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&(s->sleepers)) > 0) {
+        atomic_fetch_add(&(s->epoch), 1);
+        syscall(SYS_futex, (unsigned int *) &(s->epoch), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    return true;
+}
+
+bool scheduler_push(scheduler_t *s, const void *elem) {
+    return push(s, elem, true);
+}
+
+bool scheduler_try_push(scheduler_t *s, const void *elem) {
+    return push(s, elem, false);
+}
+
+bool scheduler_pop(scheduler_t *s, int worker, void *elem) {
+    if (s == NULL) {
+        return false;
+    }
+
+    while (!take(s, worker, elem)) {
+        // announce ourselves before the last look so a push cannot miss us
+        atomic_fetch_add(&(s->sleepers), 1);
+        unsigned int epoch = atomic_load(&(s->epoch));
+        if (take(s, worker, elem)) {
+            atomic_fetch_sub(&(s->sleepers), 1);
+            break;
+        }
+        syscall(SYS_futex, (unsigned int *) &(s->epoch), FUTEX_WAIT_PRIVATE, epoch, NULL, NULL, 0);
+        atomic_fetch_sub(&(s->sleepers), 1);
+    }
+
+    return true;
+}
+
+bool scheduler_pin(int worker) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 0) {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker % cpus, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
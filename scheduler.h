@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct scheduler scheduler_t;
+
+/** @brief Dynamically allocates and initializes a work-stealing scheduler
+ *         with one local queue of depth elements per worker.  Elements
+ *         are elem_size bytes copied in and out by value.
+ *
+ *  @param workers the number of workers.
+ *
+ *  @param depth the maximum size of each local queue.
+ *
+ *  @param elem_size the size of one element in bytes.
+ *
+ *  @return a pointer to a new scheduler_t
+ */
+scheduler_t *scheduler_new(int workers, int depth, size_t elem_size);
+
+/** @brief Delete your scheduler and free all of its memory.
+ *
+ *  @param s the scheduler to be deleted.
+ */
+void scheduler_delete(scheduler_t **s);
+
+/** @brief push an element onto the local queue of the next worker in
+ *         round-robin order, moving on to the following workers if that
+ *         queue is full.  Blocks only if every local queue is full.
+ *
+ *  @return A bool indicating success or failure.
+ */
+bool scheduler_push(scheduler_t *s, const void *elem);
+
+/** @brief push an element like scheduler_push, but without blocking.
+ *
+ *  @return A bool indicating success, or failure if every local queue
+ *          is full.
+ */
+bool scheduler_try_push(scheduler_t *s, const void *elem);
+
+/** @brief pop an element for worker, from its own local queue first and
+ *         otherwise by stealing from its neighbors.  Sleeps while every
+ *         local queue is empty.
+ *
+ *  @return A bool indicating success or failure.
+ */
+bool scheduler_pop(scheduler_t *s, int worker, void *elem);
+
+/** @brief pin the calling thread to the CPU for worker, so the worker
+ *         and its local queue stay on one core.
+ *
+ *  @return A bool indicating success or failure.
+ */
+bool scheduler_pin(int worker);
@@ -0,0 +1,335 @@
+#include "slots.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// index of no slot, the end of the free list
+#define NIL UINT32_MAX
+
+struct slot {
+    char uri[MAX_URI_LEN];
+    uint32_t hash;
+    rwlock_t *lock;
+    int num_workers;
+    struct slot *next;
+
+    // the pool index of the slot below this one on the free list
+    atomic_uint free_next;
+
+    // taken from the heap rather than the preallocated pool
+    bool heap;
+};
+
+// running lock totals of one uri, kept in the shard the uri hashes to
+struct uri_profile {
+    slots_profile_t prof;
+    uint32_t hash;
+    struct uri_profile *next;
+};
+
+struct shard {
+    pthread_mutex_t mutex;
+    struct slot *head;
+    struct uri_profile *profile;
+};
+
+struct slots {
+    struct shard *shards;
+    uint32_t num_shards;
+
+    struct slot *pool;
+    int pool_size;
+
+    // Treiber stack of pool slots: the top index in the low 32 bits, and a tag
+    // above it bumped by every push and pop, so a stale head never compares equal
+    atomic_uint_least64_t free;
+
+    atomic_ulong allocs;
+    bool profile;
+};
+
+// 32-bit FNV-1a
+static uint32_t uri_hash(const char *uri) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) uri; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static void stats_add(rwlock_stats_t *sum, const rwlock_stats_t *st) {
+    sum->reads += st->reads;
+    sum->writes += st->writes;
+    sum->read_waits += st->read_waits;
+    sum->write_waits += st->write_waits;
+    sum->read_wait_ns += st->read_wait_ns;
+    sum->write_wait_ns += st->write_wait_ns;
+    sum->read_hold_ns += st->read_hold_ns;
+    sum->write_hold_ns += st->write_hold_ns;
+    if (st->max_wait_ns > sum->max_wait_ns) {
+        sum->max_wait_ns = st->max_wait_ns;
+    }
+}
+
+static uint64_t free_head(uint64_t head, uint32_t top) {
+    return (((head >> 32) + 1) << 32) | top;
+}
+
+static struct slot *pool_pop(slots_t *t) {
+    uint64_t head = atomic_load_explicit(&t->free, memory_order_acquire);
+    uint64_t next;
+
+    do {
+        uint32_t top = (uint32_t) head;
+        if (top == NIL) {
+            return NULL;
+        }
+        // the pool is never freed while in use, so reading a slot another thread just took is harmless
+        next = free_head(head, atomic_load_explicit(&t->pool[top].free_next, memory_order_relaxed));
+    } while (!atomic_compare_exchange_weak_explicit(&t->free, &head, next, memory_order_acquire,
+        memory_order_acquire));
+
+    return &t->pool[(uint32_t) head];
+}
+
+static void pool_push(slots_t *t, struct slot *slot) {
+    uint32_t index = (uint32_t) (slot - t->pool);
+    uint64_t head = atomic_load_explicit(&t->free, memory_order_relaxed);
+
+    do {
+        atomic_store_explicit(&slot->free_next, (uint32_t) head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&t->free, &head, free_head(head, index), memory_order_release,
+        memory_order_relaxed));
+}
+
+static struct slot *slot_create(slots_t *t, const char *uri, uint32_t hash) {
+    // take a slot from the free list
+    struct slot *slot = pool_pop(t);
+
+    // the pool is sized so this never happens, but fall back to the heap if it does
+    if (slot == NULL) {
+        atomic_fetch_add_explicit(&t->allocs, 1, memory_order_relaxed);
+        slot = (struct slot *) malloc(sizeof(struct slot));
+        slot->lock = rwlock_new(N_WAY, 1);
+        slot->heap = true;
+    }
+
+    strncpy(slot->uri, uri, MAX_URI_LEN - 1);
+    slot->uri[MAX_URI_LEN - 1] = '\0';
+    slot->hash = hash;
+    slot->num_workers = 0;
+    slot->next = NULL;
+
+    return slot;
+}
+
+static void slot_destroy(slots_t *t, struct slot *slot) {
+    // a slot from the heap only covered a burst past the pool, so it goes back to the heap
+    if (slot->heap) {
+        rwlock_delete(&slot->lock);
+        free(slot);
+        return;
+    }
+
+    // no thread holds the slot, so its lock is idle and can be handed to the next uri as is
+    slot->uri[0] = '\0';
+    pool_push(t, slot);
+}
+
+// called with the shard mutex held, which also guards the shard's profiles
+static void profile_fold(struct shard *shard, struct slot *slot) {
+    struct uri_profile *p = shard->profile;
+    while (p != NULL && (p->hash != slot->hash || strcmp(p->prof.uri, slot->uri) != 0)) {
+        p = p->next;
+    }
+
+    if (p == NULL) {
+        p = (struct uri_profile *) calloc(1, sizeof(struct uri_profile));
+        strcpy(p->prof.uri, slot->uri);
+        p->hash = slot->hash;
+        p->next = shard->profile;
+        shard->profile = p;
+    }
+
+    rwlock_stats_t st;
+    rwlock_stats(slot->lock, &st, true);
+    stats_add(&p->prof.stats, &st);
+}
+
+slots_t *slots_new(int max_held, bool profile) {
+    slots_t *t = (slots_t *) calloc(1, sizeof(slots_t));
+
+    // at most max_held uris are active at once, so keep chains short by
+    // using a power of two shard count of at least twice that
+    t->num_shards = 16;
+    while (t->num_shards < (uint32_t) max_held * 2) {
+        t->num_shards <<= 1;
+    }
+
+    t->shards = (struct shard *) calloc(t->num_shards, sizeof(struct shard));
+    for (uint32_t i = 0; i < t->num_shards; i++) {
+        pthread_mutex_init(&t->shards[i].mutex, NULL);
+    }
+
+    // each thread holds at most one slot, so max_held preallocated slots
+    // (and their locks) cover every request without touching the heap
+    t->pool = (struct slot *) calloc(max_held, sizeof(struct slot));
+    t->pool_size = max_held;
+
+    for (int i = 0; i < max_held; i++) {
+        t->pool[i].lock = rwlock_new(N_WAY, 1);
+        atomic_init(&t->pool[i].free_next, i + 1 < max_held ? (uint32_t) i + 1 : NIL);
+    }
+    atomic_init(&t->free, max_held > 0 ? 0 : NIL);
+
+    atomic_init(&t->allocs, 0);
+    t->profile = profile;
+
+    return t;
+}
+
+void slots_delete(slots_t **t) {
+    if (*t == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < (*t)->num_shards; i++) {
+        struct uri_profile *p = (*t)->shards[i].profile;
+        while (p != NULL) {
+            struct uri_profile *next = p->next;
+            free(p);
+            p = next;
+        }
+        pthread_mutex_destroy(&(*t)->shards[i].mutex);
+    }
+
+    // no slot is held, so every heap slot is already freed
+    for (int i = 0; i < (*t)->pool_size; i++) {
+        rwlock_delete(&(*t)->pool[i].lock);
+    }
+
+    free((*t)->pool);
+    free((*t)->shards);
+    free(*t);
+    *t = NULL;
+}
+
+slot_t *slots_enter(slots_t *t, const char *uri) {
+    uint32_t h = uri_hash(uri);
+    struct shard *shard = &t->shards[h & (t->num_shards - 1)];
+
+    // only threads hashing to the same shard contend on this mutex
+    pthread_mutex_lock(&shard->mutex);
+
+    // if uri is in an active slot we share its lock
+    struct slot *slot = shard->head;
+    while (slot != NULL && (slot->hash != h || strcmp(slot->uri, uri) != 0)) {
+        slot = slot->next;
+    }
+
+    // otherwise the uri is not currently being accessed and gets a recycled slot
+    if (slot == NULL) {
+        slot = slot_create(t, uri, h);
+        slot->next = shard->head;
+        shard->head = slot;
+    }
+    slot->num_workers += 1;
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    return slot;
+}
+
+void slots_leave(slots_t *t, slot_t *slot) {
+    struct shard *shard = &t->shards[slot->hash & (t->num_shards - 1)];
+
+    pthread_mutex_lock(&shard->mutex);
+    slot->num_workers -= 1;
+
+    // if the slot is empty we must unlink and recycle it
+    if (slot->num_workers == 0) {
+        struct slot **link = &shard->head;
+        while (*link != slot) {
+            link = &(*link)->next;
+        }
+        *link = slot->next;
+
+        // the lock is about to serve another uri, so its counts go to this one now
+        if (t->profile) {
+            profile_fold(shard, slot);
+        }
+        slot_destroy(t, slot);
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+rwlock_t *slot_get_lock(slot_t *slot) {
+    return slot->lock;
+}
+
+uint64_t slots_allocs(slots_t *t) {
+    return atomic_load_explicit(&t->allocs, memory_order_relaxed);
+}
+
+void slots_print(slots_t *t) {
+    for (uint32_t i = 0; i < t->num_shards; i++) {
+        struct shard *shard = &t->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        for (struct slot *slot = shard->head; slot != NULL; slot = slot->next) {
+            printf("Shard %u: URI: %s, Waiting: %d\n", i, slot->uri, slot->num_workers);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+size_t slots_profile(slots_t *t, slots_profile_t **out) {
+    size_t count = 0;
+    size_t cap = 64;
+    slots_profile_t *all = (slots_profile_t *) malloc(sizeof(slots_profile_t) * cap);
+
+    for (uint32_t i = 0; i < t->num_shards; i++) {
+        struct shard *shard = &t->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+
+        // a uri only ever lives in one shard, so matches are only searched for among its entries
+        size_t first = count;
+        for (struct uri_profile *p = shard->profile; p != NULL; p = p->next) {
+            if (count == cap) {
+                cap *= 2;
+                all = (slots_profile_t *) realloc(all, sizeof(slots_profile_t) * cap);
+            }
+            all[count++] = p->prof;
+        }
+
+        for (struct slot *slot = shard->head; slot != NULL; slot = slot->next) {
+            size_t j = first;
+            while (j < count && strcmp(all[j].uri, slot->uri) != 0) {
+                j++;
+            }
+            if (j == count) {
+                if (count == cap) {
+                    cap *= 2;
+                    all = (slots_profile_t *) realloc(all, sizeof(slots_profile_t) * cap);
+                }
+                memset(&all[count], 0, sizeof(slots_profile_t));
+                strcpy(all[count].uri, slot->uri);
+                count++;
+            }
+
+            rwlock_stats_t st;
+            rwlock_stats(slot->lock, &st, false);
+            stats_add(&all[j].stats, &st);
+        }
+
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    *out = all;
+    return count;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "protocol.h"
+#include "rwlock.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct slots slots_t;
+
+typedef struct slot slot_t;
+
+/** Lock profile of one uri, summed over every slot that has served it.
+ */
+typedef struct {
+    char uri[MAX_URI_LEN];
+    rwlock_stats_t stats;
+} slots_profile_t;
+
+/** @brief Dynamically allocates a table of per-uri locks for up to
+ *         max_held slots held at once, with that many slots and locks
+ *         preallocated.  Slots go back to the pool through a lock-free
+ *         stack, only the shard a uri hashes to is locked.
+ *
+ *  @param max_held the most slots held at once, one per worker
+ *
+ *  @param profile fold each slot's lock counters into its uri's totals
+ *         when the slot is recycled
+ *
+ *  @return a pointer to a new slots_t
+ */
+slots_t *slots_new(int max_held, bool profile);
+
+/** @brief Delete your table and free all of its memory.  No slot may be
+ *         held.
+ *
+ *  @param t the table to be deleted.
+ */
+void slots_delete(slots_t **t);
+
+/** @brief Join the slot of uri, taking a recycled one if no other thread
+ *         holds it.  Threads holding the same uri share its lock.
+ *
+ *  @return the slot, to be passed to slots_leave
+ */
+slot_t *slots_enter(slots_t *t, const char *uri);
+
+/** @brief Leave slot, recycling it and its lock if this was the last
+ *         thread holding it.
+ */
+void slots_leave(slots_t *t, slot_t *slot);
+
+/** @brief The lock of slot, shared by every thread that holds it.
+ */
+rwlock_t *slot_get_lock(slot_t *slot);
+
+/** @brief The number of slots taken from the heap because every
+ *         preallocated one was held, 0 in steady state.  Heap slots are
+ *         freed again when their last thread leaves.
+ */
+uint64_t slots_allocs(slots_t *t);
+
+/** @brief Print every held slot to stdout.
+ */
+void slots_print(slots_t *t);
+
+/** @brief Snapshot the lock profile of every uri seen, including what the
+ *         slots still held have gathered.
+ *
+ *  @param out set to an array the caller frees
+ *
+ *  @return the number of uris in out
+ */
+size_t slots_profile(slots_t *t, slots_profile_t **out);
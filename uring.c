@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+
+#include "uring.h"
+#include "zerocopy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// enough for the longest chain we submit: a header send and two splices
+#define RING_ENTRIES 8
+
+// capacity we ask for the splice pipe, the kernel default is 64KiB
+#define RING_PIPE_SIZE (1 << 20)
+
+// the parts of one ring we touch, mapped from the kernel
+struct ring {
+    int fd;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned pending;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+
+    int pipe[2];
+    size_t pipe_size;
+};
+
+// each worker owns its ring, so submissions need no locking
+static __thread struct ring ring = { .fd = -1 };
+static __thread bool ring_failed = false;
+
+// tears a thread's ring down when it exits, so a retired worker does not leak it
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static int ring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned submit, unsigned wait) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void ring_close(struct ring *r) {
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_map != NULL && r->cq_map != r->sq_map) {
+        munmap(r->cq_map, r->cq_map_len);
+    }
+    if (r->sq_map != NULL) {
+        munmap(r->sq_map, r->sq_map_len);
+    }
+    if (r->pipe[0] >= 0) {
+        close(r->pipe[0]);
+        close(r->pipe[1]);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(struct ring));
+    r->fd = -1;
+    r->pipe[0] = -1;
+    r->pipe[1] = -1;
+}
+
+static void ring_release(void *arg) {
+    struct ring *r = (struct ring *) arg;
+    if (r->fd >= 0) {
+        ring_close(r);
+    }
+}
+
+static void ring_key_init(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static bool ring_open(struct ring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(struct ring));
+    r->pipe[0] = -1;
+    r->pipe[1] = -1;
+
+    r->fd = ring_setup(RING_ENTRIES, &p);
+    if (r->fd < 0) {
+        r->fd = -1;
+        return false;
+    }
+
+    // both rings come from one mapping on every kernel we care about
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring_close(r);
+        return false;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_map_len > r->sq_map_len) {
+        r->sq_map_len = r->cq_map_len;
+    }
+    r->cq_map_len = r->sq_map_len;
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+        IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        ring_close(r);
+        return false;
+    }
+    r->cq_map = r->sq_map;
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+        IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        ring_close(r);
+        return false;
+    }
+
+    char *sq = (char *) r->sq_map;
+    r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) (sq + p.sq_off.array);
+
+    char *cq = (char *) r->cq_map;
+    r->cq_head = (unsigned *) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    if (pipe2(r->pipe, O_CLOEXEC) < 0) {
+        r->pipe[0] = -1;
+        r->pipe[1] = -1;
+        ring_close(r);
+        return false;
+    }
+    int size = fcntl(r->pipe[1], F_SETPIPE_SZ, RING_PIPE_SIZE);
+    if (size < 0) {
+        size = fcntl(r->pipe[1], F_GETPIPE_SZ);
+    }
+    r->pipe_size = size > 0 ? (size_t) size : 65536;
+
+    return true;
+}
+
+static struct ring *ring_get(void) {
+    // a thread that cannot get a ring stays on the blocking path for good
+    if (ring.fd < 0 && (ring_failed || !ring_open(&ring))) {
+        ring_failed = true;
+        return NULL;
+    }
+
+    pthread_once(&ring_once, ring_key_init);
+    pthread_setspecific(ring_key, &ring);
+
+    return &ring;
+}
+
+static struct io_uring_sqe *ring_sqe(struct ring *r, uint64_t user_data, uint8_t flags) {
+    // we are the only producer, so the tail is ours to read without ordering
+    unsigned tail = *(r->sq_tail) + r->pending;
+    unsigned index = tail & *(r->sq_mask);
+
+    struct io_uring_sqe *sqe = &(r->sqes[index]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = user_data;
+    sqe->flags = flags;
+
+    r->sq_array[index] = index;
+    r->pending += 1;
+
+    return sqe;
+}
+
+// submit the pending entries and wait for all of their completions, results[i]
+// gets the result of the entry whose user data is i
+static bool ring_submit(struct ring *r, int *results) {
+    unsigned count = r->pending;
+    __atomic_store_n(r->sq_tail, *(r->sq_tail) + count, __ATOMIC_RELEASE);
+    r->pending = 0;
+
+    unsigned submit = count;
+    unsigned reaped = 0;
+    while (reaped < count) {
+        int ret = ring_enter(r->fd, submit, count - reaped);
+        if (ret < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ret > 0) {
+            submit -= (unsigned) ret < submit ? (unsigned) ret : submit;
+        }
+
+        unsigned head = *(r->cq_head);
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &(r->cqes[head & *(r->cq_mask)]);
+            if (cqe->user_data < count) {
+                results[cqe->user_data] = cqe->res;
+            }
+            reaped += 1;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+bool uring_supported(void) {
+    static int supported = -1;
+
+    if (supported < 0) {
+        struct ring probe;
+        supported = ring_open(&probe) ? 1 : 0;
+        if (supported) {
+            ring_close(&probe);
+        }
+    }
+
+    return supported == 1;
+}
+
+int uring_open(const char *path, int flags, struct stat *st) {
+    struct ring *r = ring_get();
+    if (r == NULL) {
+        int fd = open(path, flags);
+        if (fd >= 0 && fstat(fd, st) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        return fd;
+    }
+
+    // the statx is linked to the openat, so it only runs once the file is open,
+    // the caller holds the uri's lock so nothing renames the path in between
+    struct statx stx;
+    memset(&stx, 0, sizeof(stx));
+
+    struct io_uring_sqe *sqe = ring_sqe(r, 0, IOSQE_IO_LINK);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t) (uintptr_t) path;
+    sqe->open_flags = (uint32_t) flags;
+
+    sqe = ring_sqe(r, 1, 0);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t) (uintptr_t) path;
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uint64_t) (uintptr_t) &stx;
+
+    int results[2] = { -ECANCELED, -ECANCELED };
+    if (!ring_submit(r, results)) {
+        // completions still in flight would be taken for the next submission's
+        ring_close(r);
+        ring_failed = true;
+        return -1;
+    }
+
+    int fd = results[0];
+    if (fd < 0) {
+        errno = -fd;
+        return -1;
+    }
+
+    if (results[1] < 0) {
+        // the file is open, so still answer from the descriptor
+        if (fstat(fd, st) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        return fd;
+    }
+
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = stx.stx_mode;
+    st->st_size = (off_t) stx.stx_size;
+    st->st_nlink = stx.stx_nlink;
+    st->st_uid = stx.stx_uid;
+    st->st_gid = stx.stx_gid;
+    st->st_ino = stx.stx_ino;
+    st->st_atim.tv_sec = stx.stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+
+    return fd;
+}
+
+ssize_t uring_recv(int fd, void *buf, size_t len, int timeout_ms) {
+    struct ring *r = ring_get();
+    if (r == NULL) {
+        if (timeout_ms >= 0) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready <= 0) {
+                errno = ready == 0 ? ETIME : errno;
+                return -1;
+            }
+        }
+        return recv(fd, buf, len, 0);
+    }
+
+    // whichever of the recv and its timeout finishes first cancels the other
+    struct io_uring_sqe *sqe = ring_sqe(r, 0, timeout_ms >= 0 ? IOSQE_IO_LINK : 0);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) len;
+
+    struct __kernel_timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (long long) (timeout_ms % 1000) * 1000000 };
+    if (timeout_ms >= 0) {
+        sqe = ring_sqe(r, 1, 0);
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = (uint64_t) (uintptr_t) &ts;
+        sqe->len = 1;
+    }
+
+    int results[2] = { -ECANCELED, -ECANCELED };
+    if (!ring_submit(r, results)) {
+        ring_close(r);
+        ring_failed = true;
+        return -1;
+    }
+
+    if (results[0] == -ECANCELED && timeout_ms >= 0) {
+        errno = ETIME;
+        return -1;
+    }
+    if (results[0] < 0) {
+        errno = -results[0];
+        return -1;
+    }
+
+    return results[0];
+}
+
+// MSG_MORE only while a body follows, otherwise the header waits for the cork timer
+static bool send_head(int dst, const char *head, size_t hlen, bool more) {
+    for (size_t off = 0; off < hlen; ) {
+        ssize_t n = send(dst, head + off, hlen - off, (more ? MSG_MORE : 0) | MSG_NOSIGNAL);
+        if (n < 0 && errno != EINTR) {
+            return false;
+        }
+        off += n > 0 ? (size_t) n : 0;
+    }
+    return true;
+}
+
+ssize_t uring_send_file(int src, int dst, const char *head, size_t hlen, off_t offset, size_t n) {
+    struct ring *r = ring_get();
+    if (r == NULL) {
+        if (!send_head(dst, head, hlen, n > 0)) {
+            return -1;
+        }
+        return send_n_bytes(src, dst, offset, n);
+    }
+
+    size_t total = 0;
+    bool first = true;
+
+    while (total < n || (first && hlen > 0)) {
+        size_t chunk = n - total;
+        if (chunk > r->pipe_size) {
+            chunk = r->pipe_size;
+        }
+
+        // header, file into the pipe, pipe into the socket, each step only runs
+        // if the one before it completed in full
+        int slot = 0;
+        int results[3] = { -ECANCELED, -ECANCELED, -ECANCELED };
+        int head_slot = -1;
+        int in_slot = -1;
+        int out_slot = -1;
+
+        if (first && hlen > 0) {
+            head_slot = slot;
+            struct io_uring_sqe *sqe = ring_sqe(r, slot++, chunk > 0 ? IOSQE_IO_LINK : 0);
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = dst;
+            sqe->addr = (uint64_t) (uintptr_t) head;
+            sqe->len = (uint32_t) hlen;
+            sqe->msg_flags = (chunk > 0 ? MSG_MORE : 0) | MSG_NOSIGNAL | MSG_WAITALL;
+        }
+
+        if (chunk > 0) {
+            in_slot = slot;
+            struct io_uring_sqe *sqe = ring_sqe(r, slot++, IOSQE_IO_LINK);
+            sqe->opcode = IORING_OP_SPLICE;
+            sqe->splice_fd_in = src;
+            sqe->splice_off_in = (uint64_t) (offset + (off_t) total);
+            sqe->fd = r->pipe[1];
+            sqe->off = (uint64_t) -1;
+            sqe->len = (uint32_t) chunk;
+            sqe->splice_flags = SPLICE_F_MOVE;
+
+            out_slot = slot;
+            sqe = ring_sqe(r, slot++, 0);
+            sqe->opcode = IORING_OP_SPLICE;
+            sqe->splice_fd_in = r->pipe[0];
+            sqe->splice_off_in = (uint64_t) -1;
+            sqe->fd = dst;
+            sqe->off = (uint64_t) -1;
+            sqe->len = (uint32_t) chunk;
+            sqe->splice_flags = SPLICE_F_MOVE | (total + chunk < n ? SPLICE_F_MORE : 0);
+        }
+
+        if (!ring_submit(r, results)) {
+            ring_close(r);
+            ring_failed = true;
+            return -1;
+        }
+
+        if (head_slot >= 0 && results[head_slot] != (int) hlen) {
+            errno = results[head_slot] < 0 ? -results[head_slot] : EIO;
+            return -1;
+        }
+        first = false;
+
+        if (in_slot < 0) {
+            break;
+        }
+
+        int in = results[in_slot];
+        if (in < 0) {
+            // src cannot be spliced, the header is out so send the rest the old way
+            if (total == 0 && in == -EINVAL) {
+                return send_n_bytes(src, dst, offset, n);
+            }
+            errno = -in;
+            return -1;
+        }
+
+        // src is shorter than expected
+        if (in == 0) {
+            break;
+        }
+
+        // a short splice into the pipe cancels the one out of it, so finish
+        // draining whatever the pipe still holds before the next chunk
+        int out = results[out_slot] > 0 ? results[out_slot] : 0;
+        if (results[out_slot] < 0 && results[out_slot] != -ECANCELED) {
+            errno = -results[out_slot];
+            ring_close(r);
+            return -1;
+        }
+        for (ssize_t left = in - out; left > 0; ) {
+            ssize_t sent = splice(r->pipe[0], NULL, dst, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                // the pipe still holds bytes meant for dst, so the ring's pipe cannot be reused
+                ring_close(r);
+                return -1;
+            }
+            left -= sent;
+        }
+
+        total += (size_t) in;
+    }
+
+    return total;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/** @brief Checks once whether the kernel lets this process use io_uring
+ *         with the operations the engine needs.
+ *
+ *  @return true if io_uring can be used, false to stay on the blocking path.
+ */
+bool uring_supported(void);
+
+/** @brief Opens path and stats it with one io_uring submission: an
+ *         openat(2) linked to a statx(2) of the same path, on the calling
+ *         thread's ring.  Falls back to open(2) and fstat(2) when the
+ *         thread has no ring.  The path must not be renamed concurrently.
+ *
+ *  @param path The path to open.
+ *
+ *  @param flags The open(2) flags.
+ *
+ *  @param st Filled in with the file's type, permissions, size and times.
+ *
+ *  @return The new file descriptor, or, -1, indicating an error.  Sets
+ *          errno according to any errors that occur.
+ */
+int uring_open(const char *path, int flags, struct stat *st);
+
+/** @brief Receives at most len bytes from the socket fd into buf, waiting
+ *         at most timeout_ms milliseconds.  The recv and its timeout go
+ *         to the kernel as one linked submission, so a keep-alive wait and
+ *         the read of the next request cost a single io_uring_enter(2).
+ *         Falls back to poll(2) and recv(2) when the thread has no ring.
+ *
+ *  @param fd The socket to receive from.
+ *
+ *  @param buf Where the bytes go.
+ *
+ *  @param len The most bytes to receive.
+ *
+ *  @param timeout_ms The longest to wait, or -1 to wait for ever.
+ *
+ *  @return The number of bytes received, 0 once the peer has closed, or,
+ *          -1, indicating an error.  Sets errno according to any errors
+ *          that occur, ETIME if the time ran out.
+ */
+ssize_t uring_recv(int fd, void *buf, size_t len, int timeout_ms);
+
+/** @brief Sends the hlen bytes of head and then n bytes of the file src,
+ *         starting at offset, to the socket dst.  The header send and a
+ *         splice of each chunk into and out of a per-thread pipe are
+ *         submitted as one linked chain per chunk.  Falls back to
+ *         send_n_bytes when the thread has no ring or src cannot be
+ *         spliced.
+ *
+ *  @param src The file descriptor of a regular file to read from.
+ *
+ *  @param dst The socket to write to.
+ *
+ *  @param head The bytes to send before the body.
+ *
+ *  @param hlen The number of bytes in head.
+ *
+ *  @param offset The offset in src at which to start.
+ *
+ *  @param n The number of bytes of src to send.
+ *
+ *  @return The number of body bytes written, or, -1, indicating an
+ *          error.  Sets errno according to any errors that occur.
+ */
+ssize_t uring_send_file(int src, int dst, const char *head, size_t hlen, off_t offset, size_t n);
@@ -0,0 +1,105 @@
+#include "validator.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+static const char *months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static int etag_format(char *buf, size_t size, const struct stat *st, const char *coding) {
+    uint64_t mtime = (uint64_t) st->st_mtim.tv_sec * 1000000000ull + (uint64_t) st->st_mtim.tv_nsec;
+    return snprintf(buf, size, "\"%lx-%lx-%lx%s%s\"", (unsigned long) st->st_ino, (unsigned long) st->st_size,
+        (unsigned long) mtime, coding != NULL ? "-" : "", coding != NULL ? coding : "");
+}
+
+int validator_format(char *buf, size_t size, const struct stat *st, const char *coding) {
+    char etag[64];
+    etag_format(etag, sizeof(etag), st, coding);
+
+    struct tm tm;
+    gmtime_r(&(st->st_mtim.tv_sec), &tm);
+
+    char date[32];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    return snprintf(buf, size, "ETag: %s\r\nLast-Modified: %s\r\n", etag, date);
+}
+
+// only the IMF-fixdate form, "Sun, 06 Nov 1994 08:49:37 GMT", which is what everyone sends
+static bool date_parse(const char *value, time_t *out) {
+    char wday[4], mon[4];
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+
+    int end = 0;
+    if (sscanf(value, "%3s, %d %3s %d %d:%d:%d GMT%n", wday, &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour,
+            &tm.tm_min, &tm.tm_sec, &end) != 7 || end == 0 || value[end] != '\0') {
+        return false;
+    }
+
+    tm.tm_mon = -1;
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(mon, months[i]) == 0) {
+            tm.tm_mon = i;
+        }
+    }
+    if (tm.tm_mon < 0 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59
+        || tm.tm_sec > 60) {
+        return false;
+    }
+
+    tm.tm_year -= 1900;
+    *out = timegm(&tm);
+    return true;
+}
+
+// weak comparison, W/"x" matches "x"
+static bool etag_match(const char *list, const char *etag) {
+    size_t len = strlen(etag);
+    const char *p = list;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            return true;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        if (*p != '"') {
+            return false;
+        }
+
+        const char *close = strchr(p + 1, '"');
+        if (close == NULL) {
+            return false;
+        }
+        if ((size_t) (close + 1 - p) == len && strncmp(p, etag, len) == 0) {
+            return true;
+        }
+        p = close + 1;
+    }
+
+    return false;
+}
+
+bool validator_not_modified(const struct stat *st, const char *coding, const char *if_none_match,
+    const char *if_modified_since) {
+    if (if_none_match != NULL) {
+        char etag[64];
+        etag_format(etag, sizeof(etag), st, coding);
+        return etag_match(if_none_match, etag);
+    }
+
+    time_t since;
+    if (if_modified_since != NULL && date_parse(if_modified_since, &since)) {
+        return st->st_mtim.tv_sec <= since;
+    }
+
+    return false;
+}
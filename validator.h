@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// room for the header lines validator_format writes
+#define VALIDATOR_LEN 128
+
+/** @brief Writes the ETag and Last-Modified header lines, each ending in
+ *         CRLF, for the file described by st.  The ETag is built from the
+ *         inode, size and nanosecond mtime, so it changes whenever a PUT
+ *         renames a new version over the file.
+ *
+ *  @param buf The buffer to write to.
+ *
+ *  @param size The capacity of buf, at least VALIDATOR_LEN.
+ *
+ *  @param st The file's attributes.
+ *
+ *  @param coding The content coding of the body (e.g., "gzip"), which
+ *         gets its own ETag, or NULL for the file as it is.
+ *
+ *  @return The number of bytes written, as snprintf.
+ */
+int validator_format(char *buf, size_t size, const struct stat *st, const char *coding);
+
+/** @brief Evaluates If-None-Match and If-Modified-Since for a GET of the
+ *         file described by st.  If-Modified-Since is ignored when
+ *         If-None-Match is present, and when it is not a valid HTTP-date.
+ *
+ *  @param coding The content coding the body would be sent with, or NULL.
+ *
+ *  @param if_none_match The If-None-Match value, or NULL.
+ *
+ *  @param if_modified_since The If-Modified-Since value, or NULL.
+ *
+ *  @return true if the client's copy is current and a 304 should be sent.
+ */
+bool validator_not_modified(const struct stat *st, const char *coding, const char *if_none_match,
+    const char *if_modified_since);
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+
+#include "zerocopy.h"
+#include "iowrapper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+// largest count sendfile transfers in one call
+#define SENDFILE_MAX 0x7ffff000
+
+// capacity we ask for the splice pipe, the kernel default is 64KiB
+#define SPLICE_PIPE_SIZE (1 << 20)
+
+// pipe reused by every splice_n_bytes call on this thread
+static __thread int splice_pipe[2] = { -1, -1 };
+static __thread size_t splice_pipe_size = 0;
+
+// closes a thread's pipe when it exits, so a retired worker does not leak it
+static pthread_key_t splice_pipe_key;
+static pthread_once_t splice_pipe_once = PTHREAD_ONCE_INIT;
+
+static void splice_pipe_close(void) {
+    close(splice_pipe[0]);
+    close(splice_pipe[1]);
+    splice_pipe[0] = -1;
+    splice_pipe[1] = -1;
+}
+
+static void splice_pipe_release(void *arg) {
+    (void) arg;
+    if (splice_pipe[0] >= 0) {
+        splice_pipe_close();
+    }
+}
+
+static void splice_pipe_key_init(void) {
+    pthread_key_create(&splice_pipe_key, splice_pipe_release);
+}
+
+static bool splice_pipe_open(void) {
+    if (splice_pipe[0] >= 0) {
+        return true;
+    }
+    if (pipe2(splice_pipe, O_CLOEXEC) < 0) {
+        return false;
+    }
+
+    // the destructor only runs for a non-NULL value
+    pthread_once(&splice_pipe_once, splice_pipe_key_init);
+    pthread_setspecific(splice_pipe_key, splice_pipe);
+
+    int size = fcntl(splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    if (size < 0) {
+        size = fcntl(splice_pipe[1], F_GETPIPE_SZ);
+    }
+    splice_pipe_size = size > 0 ? (size_t) size : 65536;
+
+    return true;
+}
+
+ssize_t send_n_bytes(int src, int dst, off_t offset, size_t n) {
+    size_t total = 0;
+
+    while (total < n) {
+        size_t chunk = n - total;
+        if (chunk > SENDFILE_MAX) {
+            chunk = SENDFILE_MAX;
+        }
+
+        ssize_t sent = sendfile(dst, src, &offset, chunk);
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // src or dst does not support sendfile, copy the rest through user space
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS || errno == ESPIPE)) {
+                if (lseek(src, offset, SEEK_SET) < 0 && errno != ESPIPE) {
+                    return -1;
+                }
+                return pass_n_bytes(src, dst, n);
+            }
+
+            return -1;
+        }
+
+        // src is shorter than expected
+        if (sent == 0) {
+            break;
+        }
+
+        total += sent;
+    }
+
+    return total;
+}
+
+ssize_t splice_n_bytes(int src, int dst, size_t n) {
+    if (!splice_pipe_open()) {
+        return pass_n_bytes(src, dst, n);
+    }
+
+    size_t total = 0;
+
+    while (total < n) {
+        size_t chunk = n - total;
+        if (chunk > splice_pipe_size) {
+            chunk = splice_pipe_size;
+        }
+
+        ssize_t in = splice(src, NULL, splice_pipe[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (in < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // src or dst does not support splice, copy the rest through user space
+            if (total == 0 && errno == EINVAL) {
+                return pass_n_bytes(src, dst, n);
+            }
+
+            return -1;
+        }
+
+        // src is out of bytes
+        if (in == 0) {
+            break;
+        }
+
+        // drain everything we put into the pipe before reading more
+        for (ssize_t left = in; left > 0; ) {
+            ssize_t out = splice(splice_pipe[0], NULL, dst, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) {
+                continue;
+            }
+            if (out <= 0) {
+                // the pipe still holds bytes meant for dst, so it cannot be reused
+                splice_pipe_close();
+                return -1;
+            }
+            left -= out;
+        }
+
+        total += in;
+    }
+
+    return total;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** @brief Sends n bytes of the file src, starting at offset, to dst
+ *         without copying them through user space, using sendfile(2).
+ *         Falls back to pass_n_bytes when sendfile is not supported
+ *         for src/dst.
+ *
+ *  @param src The file descriptor of a regular file to read from.  Its
+ *         file offset is only changed by the fallback path.
+ *
+ *  @param dst The file descriptor or socket to write to.
+ *
+ *  @param offset The offset in src at which to start.
+ *
+ *  @param n The number of bytes to send.
+ *
+ *  @return The number of bytes written, or, -1, indicating an error.
+ *          Note: this function treats a timeout as an error.  Sets
+ *          errno according to any errors that occur.
+ */
+ssize_t send_n_bytes(int src, int dst, off_t offset, size_t n);
+
+/** @brief Moves n bytes from the socket src into the file dst through
+ *         a per-thread pipe with splice(2), without copying them through
+ *         user space.  Falls back to pass_n_bytes when splice is not
+ *         supported for src/dst.
+ *
+ *  @param src The socket (or pipe) from which to read.
+ *
+ *  @param dst The file descriptor to write to, at its current offset.
+ *
+ *  @param n The number of bytes to move.
+ *
+ *  @return The number of bytes written, which is less than n if src
+ *          ran out of bytes, or, -1, indicating an error.  Note: this
+ *          function treats a timeout as an error.  Sets errno according
+ *          to any errors that occur.
+ */
+ssize_t splice_n_bytes(int src, int dst, size_t n);